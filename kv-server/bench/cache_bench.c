@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include "cache.h"
+#include "hash.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ Cache lookup microbenchmark: fills a cache sized for 2N entries with N keys and
+ measures cache_get throughput from T threads over random keys. Half of
+ the lookups hit, half ask for keys that were never inserted.
+
+ With -p K every lookup hits one of K keys instead (the getpopular
+ pattern), and -l S gives each thread an S-slot near-cache.
+
+ -v B stores B-byte JSON-like values instead of one byte, and -z M
+ compresses values from M bytes up; the cache's byte use, compression
+ ratio and time per encode/decode are printed after the lookup rate.
+
+ With -H it instead times the key hash against the old byte-at-a-time
+ djb2 on the key shapes the load generator and clients use.
+
+ usage: cache_bench [-t threads] [-s shards] [-o lookups_per_thread] [-p hot_keys] [-l l1_slots]
+                    [-v value_bytes] [-z compress_min] [N ...]
+        cache_bench -H
+ default N: 1000000 10000000
+*/
+
+static size_t nkeys;
+static size_t lookups = 2000000;
+static size_t popular = 0;  /* hot keys every lookup goes to, 0 = uniform */
+static size_t l1_slots = 0;
+static size_t value_size = 1;
+static size_t compress_min = 0;
+static char *values; /* value_size + 64 bytes: each key's value starts at its own offset */
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* snprintf would cost more than the lookup being measured */
+static void make_key(char *buf, const char *prefix, size_t k) {
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = '0' + k % 10; k /= 10; } while (k);
+    while (*prefix) *buf++ = *prefix++;
+    while (n) *buf++ = tmp[--n];
+    *buf = 0;
+}
+
+static void *lookup_worker(void *arg) {
+    unsigned long long x = (unsigned long long)(size_t)arg * 0x9E3779B97F4A7C15ULL + 1;
+    char key[32];
+    size_t found = 0;
+    for (size_t i = 0; i < lookups; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        if (popular) make_key(key, "key:", x % popular);
+        else make_key(key, i & 1 ? "key:" : "miss:", x % nkeys);
+        cache_key_t ck;
+        cache_key_init(&ck, key);
+        cache_value_t v;
+        if (cache_get(&ck, &v) == 0) {
+            found++;
+            cache_value_release(&v);
+        }
+    }
+    return (void *)found;
+}
+
+static int run(size_t n, int threads, size_t shards) {
+    /* headroom so uneven shards evict nothing; also sizes the index up front */
+    cache_config_t cfg = { .capacity = 2 * n, .bytes = 0, .nshards = shards, .policy = CACHE_POLICY_LRU,
+                           .l1_slots = l1_slots, .compress_min = compress_min };
+    if (cache_init(&cfg) != 0) {
+        fprintf(stderr, "cache_init failed\n");
+        return -1;
+    }
+    nkeys = n;
+    char key[32];
+    double t0 = now_sec();
+    for (size_t i = 0; i < n; ++i) {
+        make_key(key, "key:", i);
+        cache_key_t ck;
+        cache_key_init(&ck, key);
+        cache_put(&ck, values + i % 64, value_size);
+    }
+    double fill = now_sec() - t0;
+
+    pthread_t tid[threads];
+    t0 = now_sec();
+    for (int i = 0; i < threads; ++i) pthread_create(&tid[i], NULL, lookup_worker, (void *)(size_t)(i + 1));
+    size_t found = 0;
+    for (int i = 0; i < threads; ++i) {
+        void *r;
+        pthread_join(tid[i], &r);
+        found += (size_t)r;
+    }
+    double el = now_sec() - t0;
+    size_t total = lookups * threads;
+    cache_stats_t st;
+    cache_stats(&st);
+    printf("keys=%zu threads=%d fill=%.2fs lookups=%zu hit=%.2f l1=%.2f  %.2f M lookups/s\n", n, threads, fill, total,
+           (double)found / total, (double)st.l1_hits / total, total / el / 1e6);
+    if (value_size > 1)
+        printf("  bytes_used=%lu compressed=%lu ratio=%.2f encode=%.0f ns decode=%.0f ns\n", st.bytes_used, st.z_items,
+               st.z_bytes ? (double)st.z_raw_bytes / st.z_bytes : 1.0,
+               st.z_compressed + st.z_skipped ? (double)st.z_encode_ns / (st.z_compressed + st.z_skipped) : 0.0,
+               st.z_decoded ? (double)st.z_decode_ns / st.z_decoded : 0.0);
+    cache_free();
+    return 0;
+}
+
+static unsigned long djb2(const char *s) {
+    unsigned long h = 5381;
+    while (*s) h = ((h << 5) + h) + (unsigned char)(*s++);
+    return h;
+}
+
+#define HASH_KEYS 4096
+#define HASH_ROUNDS 2000
+
+static volatile unsigned long hash_sink; /* keeps the loops from being optimized out */
+
+static void hash_bench(void) {
+    static char keys[HASH_KEYS][40];
+    static size_t lens[HASH_KEYS];
+    const char *shapes[] = { "p<n>", "hot<n>", "uuid" };
+    hash_seed_init();
+    for (int shape = 0; shape < 3; ++shape) {
+        unsigned long long x = 88172645463325252ULL;
+        for (int i = 0; i < HASH_KEYS; ++i) {
+            if (shape == 0) make_key(keys[i], "p", (size_t)i * 7919 % 100000);
+            else if (shape == 1) make_key(keys[i], "hot", (size_t)i % 100);
+            else {
+                unsigned long long a = x ^= x << 13, b = (x ^= x >> 7, x ^= x << 17);
+                snprintf(keys[i], sizeof(keys[i]), "%08llx-%04llx-4%03llx-a%03llx-%012llx", a >> 32, a & 0xffff,
+                         (a >> 16) & 0xfff, b >> 52, b & 0xffffffffffffULL);
+            }
+            lens[i] = strlen(keys[i]);
+        }
+        unsigned long sink = 0;
+        double t0 = now_sec();
+        for (int r = 0; r < HASH_ROUNDS; ++r)
+            for (int i = 0; i < HASH_KEYS; ++i) sink += djb2(keys[i]);
+        double t_djb2 = now_sec() - t0;
+        t0 = now_sec();
+        for (int r = 0; r < HASH_ROUNDS; ++r)
+            for (int i = 0; i < HASH_KEYS; ++i) sink += hash_bytes(keys[i], lens[i]);
+        double t_hash = now_sec() - t0;
+        /* the cache's own path also measures the length once */
+        t0 = now_sec();
+        for (int r = 0; r < HASH_ROUNDS; ++r) {
+            for (int i = 0; i < HASH_KEYS; ++i) {
+                cache_key_t ck;
+                cache_key_init(&ck, keys[i]);
+                sink += ck.hash;
+            }
+        }
+        double t_key = now_sec() - t0;
+        double n = (double)HASH_KEYS * HASH_ROUNDS / 1e9;
+        printf("%-7s e.g. %-38s djb2 %5.2f ns  hash_bytes %5.2f ns  cache_key_init %5.2f ns\n", shapes[shape], keys[1],
+               t_djb2 / n, t_hash / n, t_key / n);
+        hash_sink = sink;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "-H") == 0) {
+        hash_bench();
+        return 0;
+    }
+    int threads = 4;
+    size_t shards = 16;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc) break;
+        if (strcmp(argv[i], "-t") == 0) threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) shards = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-o") == 0) lookups = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-p") == 0) popular = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-l") == 0) l1_slots = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-v") == 0) value_size = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-z") == 0) compress_min = strtoul(argv[i + 1], NULL, 10);
+        else break;
+    }
+    if (value_size < 1) value_size = 1;
+    /* records with varying ids and flags: compresses like typical JSON, not like a run of one byte */
+    values = malloc(value_size + 64 + 64);
+    if (!values) return 1;
+    unsigned long long x = 88172645463325252ULL;
+    for (size_t o = 0; o < value_size + 64;) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        o += snprintf(values + o, 64, "{\"id\":%llu,\"active\":%s,\"score\":%llu},", x % 100000,
+                      x & 1 ? "true" : "false", (x >> 20) % 1000);
+    }
+    if (threads < 1) threads = 1;
+    if (i >= argc) {
+        run(1000000, threads, shards);
+        run(10000000, threads, shards);
+        return 0;
+    }
+    for (; i < argc; ++i) run(strtoul(argv[i], NULL, 10), threads, shards);
+    return 0;
+}
@@ -7,5 +7,13 @@ CREATE SCHEMA IF NOT EXISTS public;
 CREATE TABLE IF NOT EXISTS public.kv_store (
     key TEXT PRIMARY KEY,
     value BYTEA,
-    created_at TIMESTAMP DEFAULT now()
+    created_at TIMESTAMP DEFAULT now(),
+    expires_at TIMESTAMPTZ -- NULL = never expires
 );
+
+-- for tables created before expires_at existed
+ALTER TABLE public.kv_store ADD COLUMN IF NOT EXISTS expires_at TIMESTAMPTZ;
+CREATE INDEX IF NOT EXISTS kv_store_expires_at_idx ON public.kv_store (expires_at) WHERE expires_at IS NOT NULL;
+
+-- optional: lets --cache_warmup find its cutoff row without sorting the table
+CREATE INDEX IF NOT EXISTS kv_store_created_at_idx ON public.kv_store (created_at, key);
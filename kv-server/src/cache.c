@@ -1,203 +1,2355 @@
 #define _GNU_SOURCE
 #include "cache.h"
+#include "epoch.h"
+#include "hash.h"
+#include "slab.h"
+#include "numa.h"
+#include "lz.h"
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__) && !defined(__SANITIZE_THREAD__)
+#include <emmintrin.h>
+#endif
 
 /*
- Simple LRU cache:
-  - single global mutex for simplicity
-  - hash table with chaining; each entry is also in a doubly-linked list for LRU
+ Sharded LRU cache:
+  - callers hash a key once per request (cache_key_t, randomly seeded
+    hash from hash.h) and every call reuses it; entries keep the hash, so
+    eviction and index moves never rehash, and lookups compare hash and
+    length before the key bytes
+  - keys are spread over N shards by hash; each shard has its own mutex,
+    index, LRU list and counters so threads hitting different shards
+    never contend
+  - per shard: an open-addressing index in the style of Swiss tables. A
+    control byte per slot holds EMPTY, DELETED or a 7-bit tag from the
+    hash; 16 control bytes are compared against the tag at once (SSE2),
+    and the entry is only touched when its tag matches. Power-of-two
+    sizes, probing by groups. Past 7/8 load (counting tombstones) a new
+    table is published and every later write moves a few groups of the
+    old one into it, so growth never stalls one request. Readers search
+    the old table before the new one: a moving entry is linked into the
+    new table before it leaves the old. Each entry is also in a
+    doubly-linked list for LRU.
+  - entries may carry a deadline (cache_put_ttl). A read never returns an
+    entry past it; reclaiming is left to a per-shard hierarchical timing
+    wheel (4 levels of 64 slots, 100 ms ticks) that a background thread
+    turns, so adding, removing and expiring an entry are all O(1).
+  - refresh-ahead (cfg.refresh_ms): an entry is due for a refresh that
+    long after it was put. The first read past that serves the cached
+    value as usual, flips the entry's refreshing flag with a CAS and
+    queues the key for a background thread that calls cfg.refresh; the
+    reload goes in with cache_put_refreshed, which only replaces an entry
+    still waiting for it, so a newer put is never overwritten by an older
+    read. Unread entries are not refreshed: they expire cfg.stale_ms
+    after falling due, which bounds how stale a served value can be.
+  - negative entries (cache_put_negative) remember that a key is absent
+    from the store for a short TTL. They sit in the index like any entry,
+    so a read finds them the same way, but live on their own FIFO list
+    with their own count limit and never count towards size or bytes;
+    a put replaces one, and one never replaces a value.
+  - cache_resize changes the limits online. Growing is immediate; a
+    shrink lowers each shard's limit a batch of entries at a time so no
+    write has to evict more than that batch.
+  - lookups take no lock: slots are published with release stores before
+    their control byte, and entries are immutable once linked (an update
+    links a fresh copy), so readers only need to sit inside an epoch (see
+    epoch.h). Unlinked entries and replaced tables wait on per-shard
+    retire lists until no reader can see them.
+  - values are handed out by reference, not copied: a hit takes a count on
+    the entry (inside the epoch, so the entry can't be freed under it).
+    The cache owns one more count, dropped once a retired entry's grace
+    period ends. Whoever drops the last count frees the entry; a reader
+    can't take the shard lock for that, so it pushes the entry onto a
+    lock-free per-shard stack that the next maintain() frees.
+  - a hit does not touch the LRU list; it records the entry in one of the
+    shard's striped read buffers. The buffers are lossy rings drained under
+    the shard lock by writers, or by a reader that finds a buffer half full
+    and wins a trylock. Draining applies the promotions in batches.
+  - CLOCK policy: the list is kept in insertion order and a hit only sets
+    the entry's reference bit. evict_if_needed sweeps a hand from the tail
+    towards the head, clearing set bits, and evicts the first entry whose
+    bit is clear.
+  - TINYLFU policy (W-TinyLFU): new keys enter a small window LRU (1% of
+    the shard). Keys leaving the window compete with the main LRU's victim
+    and are only admitted if a count-min sketch of recent accesses says
+    they are more popular, so one-off scans cannot flush the hot set. The
+    sketch is fed from drained read buffers and puts, and is halved every
+    10 * capacity increments so old popularity fades.
+  - S3FIFO policy: a small FIFO (cfg.small_pct of the shard), a main FIFO
+    and a ghost queue of recently evicted key fingerprints. Hits bump a
+    2-bit counter and never reorder anything. The small queue's tail moves
+    to main if it was hit, otherwise it is evicted and remembered in the
+    ghost; a key re-inserted while still in the ghost goes straight to
+    main. Main's tail gets reinserted while its counter is non-zero.
+  - limits: a shard is full when it holds more than capacity entries or
+    when the bytes charged for its entries (struct, key and value) exceed
+    its share of cfg.bytes; either limit can be 0 to disable it. Queue
+    targets (TINYLFU window, S3FIFO small) are percentages of both.
+  - snapshots: cache_snapshot_save writes every live entry to a file,
+    coldest first per shard, so that loading it back (cache_init with
+    cfg.snapshot_path, which maps the file) re-inserts them in recency
+    order and a smaller cache keeps the hot end. Records are a fixed
+    header, key and value, each NUL terminated so they are used straight
+    from the mapping; a checksum chained over all of them is verified
+    before anything is loaded.
+  - memory: an entry is one allocation holding a 59-byte header, the key
+    and the value. Lengths are 32-bit (16 for keys) and the list, wheel
+    and retire links are 32-bit slab handles (slab.h) that are only
+    followed under the shard lock; the index and read buffers, which
+    lock-free readers use, keep pointers. The header fields a lookup
+    compares come first and a short key follows right after, so a hit on
+    a small entry mostly reads one cache line. Each shard owns a slab
+    allocator used under its lock; only entries above the largest chunk
+    size go to malloc, and those are allocated and filled before the
+    lock is taken. An entry is charged the chunk size it actually
+    occupies.
+  - near-cache (cfg.l1_slots): each thread keeps a small direct-mapped
+    table of private copies of values it read twice in a row from the
+    same slot. Every put or delete bumps its shard's write epoch after
+    publishing; a copy is only served while the epoch it was taken under
+    is still current, so a hit there reads no shared line but the epoch.
+    Every L1_RECHECK-th hit on a copy goes to the shard instead, so
+    eviction policies still see hot keys as hot. A thread's table is
+    freed when the thread exits.
+  - compression (cfg.compress_min): values from that size up are LZ
+    compressed (lz.h) before the shard lock is taken, and kept that way if
+    it saves at least 1/8 of their size; the entry is charged for what it
+    stores. A hit on one decodes it into a private copy for the reader
+    (the same kind a near-cache hands out), so the entry takes no count;
+    snapshots hold the decoded values. A compressed value starts with
+    its decoded length (4 bytes), so entries that are stored as is don't
+    carry one.
 */
 
+#define READ_BUF_STRIPES 8
+#define READ_BUF_SIZE 32 /* power of two */
+
+#define Q_WINDOW 0 /* TINYLFU admission window; the only list for LRU/CLOCK */
+#define Q_SMALL 0  /* S3FIFO small queue */
+#define Q_MAIN 1
+#define NQUEUES 2
+#define Q_NEG 2    /* negative entries, oldest at the tail */
+
+#define S3FIFO_MAX_FREQ 3
+#define GHOST_WAYS 4
+
+#define SKETCH_DEPTH 4
+#define SKETCH_MAX 15
+#define SKETCH_SAMPLE_FACTOR 10
+
+#define GROUP_WIDTH 16
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+#define INDEX_MIN_SLOTS 16
+#define MIGRATE_SLOTS 64 /* old table slots moved per write while growing */
+#define RESIZE_BATCH 256 /* entries evicted per lock hold while shrinking */
+
+#define REFRESH_QUEUE 1024 /* keys waiting for the refresher; more are dropped */
+
+#define L1_MAX_VALUE 4096 /* larger values are never copied into a near-cache */
+#define L1_RECHECK 64      /* power of two */
+#define UNZIP_SAMPLE 16    /* power of two: every so many decodes per thread are timed */
+
+/* NUMA mode: every NUMA_CHECK_TICKS wheel ticks a shard moves to the node
+   that read it most since the last check, if that node read it at least
+   NUMA_MIN_READS times and more than twice as often as its own node */
+#define NUMA_CHECK_TICKS 100
+#define NUMA_MIN_READS 10000
+
+#define SNAP_MAGIC "KVCSNAP1"
+#define SNAP_VERSION 1
+#define SNAP_SEED 0x6b7663736e617031ULL /* fixed: checksums must survive restarts */
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t saved_at; /* wall clock ms, to age TTLs across the restart */
+    uint64_t checksum; /* hash chained over every record */
+} snap_header_t;
+
+/* followed by key '\0' value '\0' */
+typedef struct {
+    uint32_t klen, vlen;
+    uint64_t ttl_ms; /* left at save time, 0 = never expires */
+} snap_rec_t;
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_TICK_MS 100
+/* furthest tick the wheel can tell apart; later deadlines wait in the last slot */
+#define WHEEL_MAX_DELTA ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+/* entry_t.flags: the queue in the low bits, then */
+#define E_QUEUE 0x03
+#define E_LINKED 0x04     /* still in index/LRU (shard lock) */
+#define E_WHEEL 0x08      /* on the timing wheel (shard lock) */
+#define E_NEGATIVE 0x10   /* key known absent; no value */
+#define E_COMPRESSED 0x20 /* value is its decoded length (uint32_t), then an lz block */
+
+/* links are slab handles of the shard's entries, 0 = none */
 typedef struct entry {
-    char *key;
-    char *value;
-    size_t klen, vlen;
-    struct entry *hnext; /* next in hash bucket */
-    struct entry *prev, *next; /* LRU list */
+    unsigned long hash;
+    uint64_t expires_at; /* monotonic ms, 0 = never */
+    uint64_t refresh_at; /* monotonic ms, 0 = no refresh-ahead */
+    uint32_t vlen;
+    atomic_uint refs;    /* the cache's count while live or retired, plus readers' */
+    slab_h self;
+    uint16_t klen;
+    unsigned char slab_cls; /* slab class or SLAB_LARGE */
+    atomic_uchar flags;  /* E_*; written under the shard lock, read by anyone */
+    union {
+        struct { slab_h prev, next; }; /* LRU list (shard lock) */
+        uint64_t retire_epoch;         /* once unlinked */
+    };
+    union {
+        struct { slab_h wnext, wprev; }; /* timing wheel slot list (shard lock) */
+        slab_h rnext;                    /* retire list, then the shard's orphan stack */
+    };
+    unsigned char wslot; /* wheel level << WHEEL_BITS | slot, for the first entry of a slot */
+    atomic_uchar freq; /* CLOCK reference bit, S3FIFO access counter */
+    atomic_uchar refreshing; /* a reload is queued or running */
+    char data[]; /* key value '\0' */
 } entry_t;
 
+#define ENTRY_HEADER offsetof(entry_t, data)
+
+static inline const char *entry_key(const entry_t *e) { return e->data; }
+static inline const char *entry_value(const entry_t *e) { return e->data + e->klen; }
+
+static inline unsigned entry_flags(const entry_t *e) {
+    return atomic_load_explicit(&((entry_t *)e)->flags, memory_order_relaxed);
+}
+
+/* only the shard lock holder (or the filler, before publishing) changes flags */
+static inline void entry_set_flags(entry_t *e, unsigned set, unsigned clear) {
+    atomic_store_explicit(&e->flags, (unsigned char)((entry_flags(e) & ~clear) | set), memory_order_relaxed);
+}
+
+static inline int entry_queue(const entry_t *e) { return (int)(entry_flags(e) & E_QUEUE); }
+
+/* decoded length of a compressed value, 0 for one stored as is */
+static inline uint32_t entry_ulen(const entry_t *e) {
+    uint32_t u = 0;
+    if (entry_flags(e) & E_COMPRESSED) memcpy(&u, entry_value(e), sizeof(u));
+    return u;
+}
+
+/* open-addressing index; ctrl bytes are written with atomic byte stores */
+typedef struct index {
+    unsigned char *ctrl; /* nslots control bytes */
+    _Atomic(entry_t *) *slots;
+    size_t mask;         /* nslots - 1 */
+    size_t used;         /* full slots (shard lock) */
+    size_t tombstones;   /* DELETED slots (shard lock) */
+    _Atomic(struct index *) prev; /* older table still moving into this one */
+    _Atomic(struct index *) next; /* set once entries start moving out */
+    size_t moved;        /* slots already moved out (shard lock) */
+    size_t map_len;      /* ctrl and slots share one numa_mem_alloc block of this size, 0 = malloc'd */
+    uint64_t retire_epoch;
+    struct index *rnext; /* retire list */
+} index_t;
+
+/* one stripe of a shard's read buffer, on its own cache line */
+typedef struct {
+    atomic_ulong head; /* next slot to claim (readers) */
+    atomic_ulong tail; /* next slot to drain (shard lock) */
+    _Atomic(entry_t *) slots[READ_BUF_SIZE];
+    atomic_ulong hits, misses, neg_hits, stale_hits;
+    atomic_ulong numa_local, numa_remote;
+    atomic_ulong unzips, unzip_ns; /* hits on compressed entries; ns of the timed ones */
+    atomic_ulong node_reads[NUMA_MAX_NODES]; /* lookups by reader node (NUMA mode) */
+} __attribute__((aligned(64))) read_buf_t;
+
 typedef struct {
-    entry_t **buckets;
-    size_t nbuckets;
-    entry_t *lru_head, *lru_tail;
-    size_t capacity;
+    entry_t *head, *tail;
     size_t size;
+    size_t bytes; /* sum of entry_charge() */
+} lru_list_t;
+
+/* count-min sketch of access frequency with 4-bit style saturating counters */
+typedef struct {
+    unsigned char *table; /* SKETCH_DEPTH rows of width counters */
+    size_t width;         /* power of two */
+    size_t additions, sample_size;
+} sketch_t;
+
+/* S3FIFO ghost: fingerprints of keys evicted from the small queue. Each
+   slot remembers the insertion sequence number; a fingerprint counts as
+   present while fewer than cap insertions have happened since, which
+   approximates a FIFO of cap entries without keeping one. */
+typedef struct {
+    unsigned int *fp;
+    unsigned int *seq; /* 0 = empty */
+    size_t nslots;     /* power of two */
+    size_t cap;
+    unsigned int clock;
+} ghost_t;
+
+/* hierarchical timing wheel: level l slot i holds entries due in the
+   64^l-tick span that slot covers, relative to tick */
+typedef struct {
+    slab_h slots[WHEEL_LEVELS][WHEEL_SLOTS]; /* first entry of each, 0 = empty */
+    uint64_t tick;  /* next tick to process */
+    size_t count;
+} wheel_t;
+
+/* a private copy, key '\0' value '\0': a near-cache copy, freed when
+   replaced or by the last cache_value_release once it has been replaced;
+   or a decoded value handed to one reader (detached from the start) */
+typedef struct {
+    unsigned pins;   /* values handed out and not released yet */
+    int detached;    /* no longer in its slot */
+    size_t klen, vlen;
+    uint64_t expires_at, refresh_at; /* the entry's, copied */
+    char data[];
+} l1_val_t;
+
+typedef struct {
+    l1_val_t *val;
+    unsigned long hash;
+    unsigned long epoch; /* shard write epoch val was copied under */
+    unsigned long cand;  /* hash that last missed here: copied if it comes again */
+    unsigned uses;
+} l1_slot_t;
+
+/* one thread's near-cache; kept on a list until the thread exits or cache_free */
+typedef struct l1 {
+    struct l1 *next;
+    atomic_ulong hits; /* written by its thread only */
+    l1_slot_t slots[];
+} l1_t;
+
+/* aligned so neighbouring shard locks don't share a cache line */
+typedef struct {
+    _Atomic(index_t *) index;
+    lru_list_t lists[NQUEUES + 1]; /* plus Q_NEG */
+    entry_t *hand; /* CLOCK hand; NULL means start at the tail */
+    sketch_t sketch; /* TINYLFU only */
+    ghost_t ghost; /* S3FIFO only */
+    size_t q0_pct; /* TINYLFU window / S3FIFO small queue share */
+    slab_t slab;
+    size_t capacity; /* max entries, 0 = no entry limit */
+    size_t bytes_cap; /* max charged bytes, 0 = no byte limit */
+    size_t size; /* entries with a value */
+    size_t neg_cap; /* max bytes charged for negative entries, 0 = none kept */
+    wheel_t wheel;
+    unsigned long expired;
+    unsigned long evicted; /* to make room */
+    unsigned long puts; /* values linked; read unlocked by cache_write_seq */
+    int node; /* NUMA node of its slab pages and index, -1 = not placed */
+    unsigned long node_seen[NUMA_MAX_NODES]; /* node_reads at the last check (ticker) */
+    unsigned long numa_moves;
+    unsigned long z_items, z_raw, z_stored; /* compressed entries linked, value bytes before and after */
+    unsigned long z_puts, z_skipped, z_ns;  /* values compressed, not worth it, time spent */
     pthread_mutex_t mu;
-    unsigned long hits, misses;
+    entry_t *retired_head, *retired_tail;
+    index_t *retired_index;
+    atomic_uint orphans; /* handles released by the last reader, to be freed */
+    read_buf_t rbuf[READ_BUF_STRIPES];
+    /* bumped after every put or delete; own line, read on each near-cache hit */
+    atomic_ulong wepoch __attribute__((aligned(64)));
+} __attribute__((aligned(64))) shard_t;
+
+typedef struct {
+    shard_t *shards;
+    size_t nshards;
+    cache_policy_t policy;
+    unsigned long neg_ttl_ms;
+    pthread_mutex_t resize_mu; /* one cache_resize at a time */
+    pthread_t ticker; /* turns the timing wheels */
+    pthread_mutex_t ticker_mu;
+    pthread_cond_t ticker_cv;
+    int ticker_stop;
+    /* eviction history for cache_debug (ticker_mu) */
+    uint64_t hist_at; /* when the last interval ended, monotonic ms */
+    unsigned long hist_evicted, hist_expired; /* totals then */
+    unsigned long evict_hist[CACHE_DEBUG_HISTORY], expire_hist[CACHE_DEBUG_HISTORY];
+    int hist_pos, hist_len;
+    unsigned long refresh_ms, stale_ms;
+    cache_refresh_fn refresh;
+    pthread_t refresher; /* runs cfg.refresh for queued keys */
+    pthread_mutex_t refresh_mu;
+    pthread_cond_t refresh_cv;
+    int refresh_stop; /* -1 = no refresher */
+    cache_key_t refresh_q[REFRESH_QUEUE]; /* ring of owned key copies */
+    size_t refresh_head, refresh_len;
+    unsigned long refreshes, refresh_dropped;
+    int numa_nodes; /* 0 = NUMA mode off */
+    size_t l1_slots; /* 0 = no near-caches */
+    size_t compress_min; /* 0 = values are stored as is */
+    unsigned long gen; /* tells threads' near-caches of an earlier cache_init apart */
+    pthread_mutex_t l1_mu;
+    l1_t *l1_list;
+    unsigned long l1_gone_hits; /* of near-caches whose threads exited */
 } cache_t;
 
 static cache_t *cache = NULL;
 
-static size_t default_nbuckets(size_t cap) {
-    return (cap * 2) + 3;
+/* each thread sticks to one read buffer stripe */
+static atomic_uint next_stripe = 0;
+static __thread int my_stripe = -1;
+
+static unsigned long cache_gen = 0;
+static __thread l1_t *my_l1;
+static __thread unsigned long my_l1_gen;
+static pthread_key_t l1_exit_key;
+static pthread_once_t l1_exit_once = PTHREAD_ONCE_INIT;
+static __thread unsigned my_unzips;
+
+/* rough entry size used to size tables when only a byte budget is given */
+#define EST_ENTRY_BYTES 256
+
+static size_t default_nslots(size_t cap) {
+    size_t n = INDEX_MIN_SLOTS;
+    while (n * 7 / 8 < cap + 1) n <<= 1;
+    return n;
+}
+
+/* the entry behind a handle; caller holds the shard lock */
+static inline entry_t *ent(const shard_t *s, slab_h h) {
+    return slab_ptr(&s->slab, h);
 }
 
-static unsigned long hash_fn(const char *s) {
-    unsigned long h = 5381;
-    while (*s) h = ((h << 5) + h) + (unsigned char)(*s++);
-    return h;
+/* bytes an entry counts against the budget: the chunk it sits in */
+static size_t entry_charge(const shard_t *s, const entry_t *e) {
+    if (e->slab_cls == SLAB_LARGE) return ENTRY_HEADER + e->klen + e->vlen + 1;
+    return s->slab.classes[e->slab_cls].chunk_size;
 }
 
-int cache_init(size_t capacity) {
+/* avalanche a hash so that every bit depends on every input bit */
+static unsigned long long mix64(unsigned long long x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+void cache_key_init(cache_key_t *k, const char *str) {
+    k->str = str;
+    k->len = strlen(str);
+    k->hash = (unsigned long)hash_bytes(str, k->len);
+}
+
+/* pick the shard from the high bits of a multiplicative remix so that shard
+   choice stays independent of the slot index (low hash bits) */
+static shard_t *shard_for(unsigned long h) {
+    unsigned long long m = (unsigned long long)h * 0x9E3779B97F4A7C15ULL;
+    return &cache->shards[(m >> 32) % cache->nshards];
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* expected entry count of a shard with these limits, used to size its tables */
+static size_t est_entries(size_t capacity, size_t bytes_cap) {
+    size_t est = capacity;
+    if (!est || (bytes_cap && bytes_cap / EST_ENTRY_BYTES < est)) est = bytes_cap / EST_ENTRY_BYTES;
+    return est ? est : 1;
+}
+
+/* S3FIFO ghost remembers about as many keys as the main queue holds */
+static size_t ghost_cap(size_t est, size_t q0_pct) {
+    size_t cap = est - est * q0_pct / 100;
+    return cap ? cap : 1;
+}
+
+/* shard i's part of a cache-wide limit; a non-zero limit never becomes 0
+   (unlimited) for a shard */
+static size_t shard_share(size_t total, size_t nshards, size_t i) {
+    if (!total) return 0;
+    size_t v = total / nshards + (i < total % nshards ? 1 : 0);
+    return v ? v : 1;
+}
+
+static int sketch_init(sketch_t *sk, size_t capacity) {
+    size_t w = 64;
+    while (w < capacity) w <<= 1;
+    sk->table = calloc(SKETCH_DEPTH * w, 1);
+    if (!sk->table) return -1;
+    sk->width = w;
+    sk->additions = 0;
+    sk->sample_size = SKETCH_SAMPLE_FACTOR * (capacity ? capacity : 1);
+    return 0;
+}
+
+/* row i uses double hashing: h1 + i * h2 */
+static size_t sketch_index(const sketch_t *sk, unsigned long long m, int i) {
+    unsigned long long h2 = (m >> 32) | 1;
+    return (size_t)i * sk->width + (size_t)((m + (unsigned long long)i * h2) & (sk->width - 1));
+}
+
+static unsigned sketch_freq(const sketch_t *sk, unsigned long hash) {
+    unsigned long long m = mix64(hash);
+    unsigned f = SKETCH_MAX;
+    for (int i = 0; i < SKETCH_DEPTH; ++i) {
+        unsigned c = sk->table[sketch_index(sk, m, i)];
+        if (c < f) f = c;
+    }
+    return f;
+}
+
+/* halve every counter so popularity decays over time */
+static void sketch_age(sketch_t *sk) {
+    for (size_t i = 0; i < SKETCH_DEPTH * sk->width; ++i) sk->table[i] >>= 1;
+    sk->additions /= 2;
+}
+
+static void sketch_increment(sketch_t *sk, unsigned long hash) {
+    unsigned long long m = mix64(hash);
+    int added = 0;
+    for (int i = 0; i < SKETCH_DEPTH; ++i) {
+        unsigned char *c = &sk->table[sketch_index(sk, m, i)];
+        if (*c < SKETCH_MAX) { (*c)++; added = 1; }
+    }
+    if (added && ++sk->additions >= sk->sample_size) sketch_age(sk);
+}
+
+static int ghost_init(ghost_t *g, size_t cap) {
+    size_t n = GHOST_WAYS;
+    while (n < 2 * cap) n <<= 1;
+    g->fp = calloc(n, sizeof(*g->fp));
+    g->seq = calloc(n, sizeof(*g->seq));
+    if (!g->fp || !g->seq) { free(g->fp); free(g->seq); g->fp = NULL; g->seq = NULL; return -1; }
+    g->nslots = n;
+    g->cap = cap ? cap : 1;
+    g->clock = 0;
+    return 0;
+}
+
+static int ghost_live(const ghost_t *g, size_t i) {
+    return g->seq[i] && g->clock - g->seq[i] < g->cap;
+}
+
+static void ghost_add(ghost_t *g, unsigned long hash) {
+    unsigned long long m = mix64(hash);
+    unsigned int fp = (unsigned int)(m >> 32);
+    size_t base = (size_t)m & (g->nslots - 1) & ~(size_t)(GHOST_WAYS - 1);
+    size_t slot = base;
+    /* reuse a dead slot or one with the same fingerprint, else the oldest */
+    for (size_t i = base; i < base + GHOST_WAYS; ++i) {
+        if (!ghost_live(g, i) || g->fp[i] == fp) { slot = i; break; }
+        if (g->clock - g->seq[i] > g->clock - g->seq[slot]) slot = i;
+    }
+    if (++g->clock == 0) { /* wrapped: forget everything rather than misjudge ages */
+        memset(g->seq, 0, g->nslots * sizeof(*g->seq));
+        g->clock = 1;
+    }
+    g->fp[slot] = fp;
+    g->seq[slot] = g->clock;
+}
+
+/* returns 1 and forgets the fingerprint if hash was recently evicted */
+static int ghost_take(ghost_t *g, unsigned long hash) {
+    unsigned long long m = mix64(hash);
+    unsigned int fp = (unsigned int)(m >> 32);
+    size_t base = (size_t)m & (g->nslots - 1) & ~(size_t)(GHOST_WAYS - 1);
+    for (size_t i = base; i < base + GHOST_WAYS; ++i) {
+        if (ghost_live(g, i) && g->fp[i] == fp) { g->seq[i] = 0; return 1; }
+    }
+    return 0;
+}
+
+static unsigned long ghost_count(const ghost_t *g) {
+    unsigned long n = 0;
+    for (size_t i = 0; i < g->nslots; ++i) n += (unsigned long)ghost_live(g, i);
+    return n;
+}
+
+static unsigned char hash_tag(unsigned long hash) {
+    return (unsigned char)(hash >> 57); /* 7 bits: never looks like EMPTY/DELETED */
+}
+
+/* node >= 0 puts the table on that NUMA node */
+static index_t *index_new(size_t nslots, int node) {
+    index_t *ix = calloc(1, sizeof(index_t));
+    if (!ix) return NULL;
+    if (node >= 0) {
+        /* one block, control bytes first: nslots keeps the slots aligned */
+        size_t len = nslots + nslots * sizeof(ix->slots[0]);
+        char *m = numa_mem_alloc(len, node);
+        if (!m) { free(ix); return NULL; }
+        ix->ctrl = (unsigned char *)m;
+        ix->slots = (void *)(m + nslots);
+        ix->map_len = len;
+    } else {
+        ix->ctrl = aligned_alloc(GROUP_WIDTH, nslots);
+        ix->slots = calloc(nslots, sizeof(ix->slots[0]));
+        if (!ix->ctrl || !ix->slots) { free(ix->ctrl); free(ix->slots); free(ix); return NULL; }
+    }
+    memset(ix->ctrl, CTRL_EMPTY, nslots);
+    ix->mask = nslots - 1;
+    return ix;
+}
+
+static void index_free(index_t *ix) {
+    if (ix->map_len) {
+        numa_mem_free(ix->ctrl, ix->map_len);
+    } else {
+        free(ix->ctrl);
+        free(ix->slots);
+    }
+    free(ix);
+}
+
+/* bitmasks over one group of control bytes: slots whose tag equals tag, and
+   slots that are EMPTY. Readers race with writers' byte stores; each byte
+   is seen either before or after a store, and a stale view at worst makes
+   a concurrent insert invisible to this lookup. TSan can't see that through
+   a vector load, so it gets the scalar version. */
+#if defined(__SSE2__) && !defined(__SANITIZE_THREAD__)
+static unsigned group_match(const unsigned char *g, unsigned char tag) {
+    __m128i v = _mm_load_si128((const __m128i *)g);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)tag)));
+}
+
+static unsigned group_match_empty(const unsigned char *g) {
+    __m128i v = _mm_load_si128((const __m128i *)g);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)CTRL_EMPTY)));
+}
+#else
+static unsigned group_match(const unsigned char *g, unsigned char tag) {
+    unsigned m = 0;
+    for (int i = 0; i < GROUP_WIDTH; ++i)
+        if (__atomic_load_n(&g[i], __ATOMIC_RELAXED) == tag) m |= 1u << i;
+    return m;
+}
+
+static unsigned group_match_empty(const unsigned char *g) {
+    return group_match(g, CTRL_EMPTY);
+}
+#endif
+
+/* EMPTY and DELETED both have the top bit set */
+static unsigned group_match_free(const unsigned char *g) {
+    unsigned m = 0;
+    for (int i = 0; i < GROUP_WIDTH; ++i)
+        if (__atomic_load_n(&g[i], __ATOMIC_RELAXED) & 0x80) m |= 1u << i;
+    return m;
+}
+
+static void set_ctrl(index_t *ix, size_t i, unsigned char c) {
+    __atomic_store_n(&ix->ctrl[i], c, __ATOMIC_RELEASE);
+}
+
+/* slot holding key, or (size_t)-1; *out gets the entry. Safe for lock-free
+   readers inside an epoch: the entry is loaded once and checked, so a slot
+   reused under a reader at worst yields a miss. */
+static size_t index_find(const index_t *ix, const cache_key_t *k, entry_t **out) {
+    unsigned long hash = k->hash;
+    unsigned char tag = hash_tag(hash);
+    size_t pos = (size_t)hash & ix->mask & ~(size_t)(GROUP_WIDTH - 1);
+    /* both addresses are known up front: overlap the slot miss with the ctrl miss */
+    __builtin_prefetch(&ix->slots[pos + ((size_t)hash & (GROUP_WIDTH - 1))]);
+    for (size_t step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+        const unsigned char *g = ix->ctrl + pos;
+        unsigned m = group_match(g, tag);
+        atomic_thread_fence(memory_order_acquire);
+        while (m) {
+            size_t i = pos + (size_t)__builtin_ctz(m);
+            entry_t *e = atomic_load_explicit(&ix->slots[i], memory_order_acquire);
+            if (e && e->hash == hash && e->klen == k->len && memcmp(entry_key(e), k->str, k->len) == 0) {
+                *out = e;
+                return i;
+            }
+            m &= m - 1;
+        }
+        if (group_match_empty(g) || step > ix->mask) { *out = NULL; return (size_t)-1; }
+        pos = (pos + step) & ix->mask;
+    }
+}
+
+/* slot holding exactly e in one table; caller holds the shard lock */
+static size_t index_find_entry(const index_t *ix, const entry_t *e) {
+    unsigned char tag = hash_tag(e->hash);
+    size_t pos = (size_t)e->hash & ix->mask & ~(size_t)(GROUP_WIDTH - 1);
+    for (size_t step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+        unsigned m = group_match(ix->ctrl + pos, tag);
+        while (m) {
+            size_t i = pos + (size_t)__builtin_ctz(m);
+            if (atomic_load_explicit(&ix->slots[i], memory_order_relaxed) == e) return i;
+            m &= m - 1;
+        }
+        if (group_match_empty(ix->ctrl + pos) || step > ix->mask) return (size_t)-1;
+        pos = (pos + step) & ix->mask;
+    }
+}
+
+/* place e (whose key is absent) in the first free slot of its probe
+   sequence; the slot is published before its tag */
+static void index_insert(index_t *ix, entry_t *e) {
+    size_t pos = (size_t)e->hash & ix->mask & ~(size_t)(GROUP_WIDTH - 1);
+    for (size_t step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+        unsigned m = group_match_free(ix->ctrl + pos);
+        if (m) {
+            size_t i = pos + (size_t)__builtin_ctz(m);
+            if (ix->ctrl[i] == CTRL_DELETED) ix->tombstones--;
+            ix->used++;
+            atomic_store_explicit(&ix->slots[i], e, memory_order_release);
+            set_ctrl(ix, i, hash_tag(e->hash));
+            return;
+        }
+        pos = (pos + step) & ix->mask;
+    }
+}
+
+/* DELETED (not EMPTY) keeps later keys of the same probe chain reachable */
+static void index_erase(index_t *ix, size_t i) {
+    set_ctrl(ix, i, CTRL_DELETED);
+    atomic_store_explicit(&ix->slots[i], NULL, memory_order_release);
+    ix->used--;
+    ix->tombstones++;
+}
+
+/* lock-free lookup over the current table and, while it is growing, the
+   one it replaces. The older table goes first: a moving entry is linked
+   into the newer one before it is erased from the older. */
+static entry_t *index_lookup(shard_t *s, const cache_key_t *k) {
+    entry_t *e;
+    for (;;) {
+        index_t *ix = atomic_load_explicit(&s->index, memory_order_acquire);
+        index_t *old = atomic_load_explicit(&ix->prev, memory_order_acquire);
+        if (old && index_find(old, k, &e) != (size_t)-1) return e;
+        if (index_find(ix, k, &e) != (size_t)-1) return e;
+        /* entries started leaving ix while we looked: start over on the new table */
+        if (!atomic_load_explicit(&ix->next, memory_order_acquire)) return NULL;
+    }
+}
+
+/* table and slot holding key, or NULL; caller holds the shard lock */
+static index_t *index_locate(shard_t *s, const cache_key_t *k, size_t *slot, entry_t **e) {
+    index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed);
+    index_t *old = atomic_load_explicit(&ix->prev, memory_order_relaxed);
+    if (old && (*slot = index_find(old, k, e)) != (size_t)-1) return old;
+    if ((*slot = index_find(ix, k, e)) != (size_t)-1) return ix;
+    return NULL;
+}
+
+static void index_remove_entry(shard_t *s, const entry_t *e) {
+    index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed);
+    index_t *old = atomic_load_explicit(&ix->prev, memory_order_relaxed);
+    size_t slot;
+    if (old && (slot = index_find_entry(old, e)) != (size_t)-1) index_erase(old, slot);
+    else if ((slot = index_find_entry(ix, e)) != (size_t)-1) index_erase(ix, slot);
+}
+
+static read_buf_t *stripe_for(shard_t *s) {
+    if (my_stripe < 0) my_stripe = (int)(atomic_fetch_add(&next_stripe, 1) % READ_BUF_STRIPES);
+    return &s->rbuf[my_stripe];
+}
+
+static void *ticker_main(void *arg);
+static void *refresher_main(void *arg);
+
+/* clear the refreshing flag of whatever entry the key maps to now */
+static void refresh_abandon(const cache_key_t *key) {
+    shard_t *s = shard_for(key->hash);
+    epoch_enter();
+    entry_t *e = index_lookup(s, key);
+    if (e) atomic_store_explicit(&e->refreshing, 0, memory_order_relaxed);
+    epoch_exit();
+}
+
+int cache_init(const cache_config_t *cfg) {
     if (cache) return 0;
+    size_t nshards = cfg->nshards ? cfg->nshards : 1;
+    /* every shard should be able to hold at least one entry */
+    if (cfg->capacity && nshards > cfg->capacity) nshards = cfg->capacity;
+    if (cfg->bytes && nshards > cfg->bytes / EST_ENTRY_BYTES)
+        nshards = cfg->bytes / EST_ENTRY_BYTES ? cfg->bytes / EST_ENTRY_BYTES : 1;
     cache = calloc(1, sizeof(cache_t));
     if (!cache) return -1;
-    cache->capacity = capacity;
-    cache->nbuckets = default_nbuckets(capacity);
-    cache->buckets = calloc(cache->nbuckets, sizeof(entry_t *));
-    if (!cache->buckets) { free(cache); cache = NULL; return -1; }
-    pthread_mutex_init(&cache->mu, NULL);
-    cache->lru_head = cache->lru_tail = NULL;
-    cache->size = 0;
-    cache->hits = cache->misses = 0;
+    cache->shards = aligned_alloc(64, nshards * sizeof(shard_t));
+    if (!cache->shards) { free(cache); cache = NULL; return -1; }
+    memset(cache->shards, 0, nshards * sizeof(shard_t));
+    cache->nshards = nshards;
+    cache->policy = cfg->policy;
+    cache->neg_ttl_ms = cfg->neg_ttl_ms;
+    cache->refresh = cfg->refresh_ms ? cfg->refresh : NULL;
+    cache->refresh_ms = cache->refresh ? cfg->refresh_ms : 0;
+    cache->stale_ms = cfg->stale_ms;
+    cache->refresh_stop = -1;
+    cache->numa_nodes = cfg->numa ? numa_topo_init() : 0;
+    if (cfg->l1_slots) {
+        size_t n = 1;
+        while (n < cfg->l1_slots) n <<= 1;
+        cache->l1_slots = n;
+    }
+    cache->compress_min = cfg->compress_min;
+    cache->gen = ++cache_gen;
+    pthread_mutex_init(&cache->l1_mu, NULL);
+    pthread_mutex_init(&cache->resize_mu, NULL);
+    hash_seed_init();
+    for (size_t i = 0; i < nshards; ++i) {
+        shard_t *s = &cache->shards[i];
+        /* spread the limits so the shard limits add up to the configured ones */
+        s->capacity = shard_share(cfg->capacity, nshards, i);
+        s->bytes_cap = shard_share(cfg->bytes, nshards, i);
+        s->neg_cap = cfg->neg_ttl_ms ? shard_share(cfg->neg_bytes, nshards, i) : 0;
+        size_t est = est_entries(s->capacity, s->bytes_cap);
+        s->node = cache->numa_nodes ? (int)(i % (size_t)cache->numa_nodes) : -1;
+        index_t *ix = index_new(default_nslots(est), s->node);
+        atomic_init(&s->index, ix);
+        size_t pct = cfg->small_pct ? cfg->small_pct : 10;
+        if (pct > 90) pct = 90;
+        s->q0_pct = cfg->policy == CACHE_POLICY_TINYLFU ? 1 : pct;
+        if (ix && cfg->policy == CACHE_POLICY_TINYLFU && sketch_init(&s->sketch, est) != 0) {
+            index_free(ix);
+            ix = NULL;
+        }
+        if (ix && cfg->policy == CACHE_POLICY_S3FIFO &&
+            ghost_init(&s->ghost, ghost_cap(est, pct)) != 0) {
+            index_free(ix);
+            ix = NULL;
+        }
+        if (!ix) {
+            for (size_t j = 0; j < i; ++j) {
+                index_free(atomic_load(&cache->shards[j].index));
+                free(cache->shards[j].sketch.table);
+                free(cache->shards[j].ghost.fp);
+                free(cache->shards[j].ghost.seq);
+                pthread_mutex_destroy(&cache->shards[j].mu);
+            }
+            free(cache->shards);
+            pthread_mutex_destroy(&cache->resize_mu);
+            free(cache);
+            cache = NULL;
+            return -1;
+        }
+        pthread_mutex_init(&s->mu, NULL);
+        slab_init(&s->slab);
+        if (s->node >= 0) slab_set_node(&s->slab, s->node);
+        s->size = 0;
+        s->wheel.tick = now_ms() / WHEEL_TICK_MS;
+    }
+    pthread_mutex_init(&cache->ticker_mu, NULL);
+    pthread_cond_init(&cache->ticker_cv, NULL);
+    cache->hist_at = now_ms();
+    pthread_mutex_init(&cache->refresh_mu, NULL);
+    pthread_cond_init(&cache->refresh_cv, NULL);
+    if (pthread_create(&cache->ticker, NULL, ticker_main, NULL) != 0) {
+        cache->ticker_stop = -1; /* never started: nothing to join */
+        cache_free();
+        return -1;
+    }
+    if (cache->refresh) {
+        cache->refresh_stop = 0;
+        if (pthread_create(&cache->refresher, NULL, refresher_main, NULL) != 0) {
+            cache->refresh_stop = -1;
+            cache_free();
+            return -1;
+        }
+    }
+    if (cfg->snapshot_path) {
+        int n = cache_snapshot_load(cfg->snapshot_path);
+        if (n >= 0) fprintf(stderr, "cache: loaded %d entries from %s\n", n, cfg->snapshot_path);
+    }
     return 0;
 }
 
-static void detach_lru(entry_t *e) {
-    if (!e) return;
-    if (e->prev) e->prev->next = e->next;
-    else cache->lru_head = e->next;
-    if (e->next) e->next->prev = e->prev;
-    else cache->lru_tail = e->prev;
-    e->prev = e->next = NULL;
-}
-
-static void insert_head(entry_t *e) {
-    e->prev = NULL;
-    e->next = cache->lru_head;
-    if (cache->lru_head) cache->lru_head->prev = e;
-    cache->lru_head = e;
-    if (!cache->lru_tail) cache->lru_tail = e;
-}
-
-static void evict_if_needed() {
-    while (cache->size > cache->capacity && cache->lru_tail) {
-        entry_t *e = cache->lru_tail;
-        /* remove from hash */
-        unsigned long h = hash_fn(e->key) % cache->nbuckets;
-        entry_t **pp = &cache->buckets[h];
-        while (*pp && *pp != e) pp = &(*pp)->hnext;
-        if (*pp == e) *pp = e->hnext;
-        /* remove from lru */
-        detach_lru(e);
-        /* free */
-        free(e->key);
-        free(e->value);
+/* caller holds s->mu */
+static void free_entry(shard_t *s, entry_t *e) {
+    if (e->slab_cls == SLAB_LARGE) {
+        s->slab.large_count--;
+        s->slab.large_bytes -= entry_charge(s, e);
+        slab_large_del(&s->slab, e->self);
         free(e);
-        cache->size--;
+    } else {
+        slab_free(&s->slab, e->slab_cls, e, e->self);
     }
 }
 
-char *cache_get(const char *key) {
-    if (!cache) return NULL;
-    pthread_mutex_lock(&cache->mu);
-    unsigned long h = hash_fn(key) % cache->nbuckets;
-    entry_t *cur = cache->buckets[h];
-    while (cur) {
-        if (strcmp(cur->key, key) == 0) {
-            /* hit: move to head */
-            detach_lru(cur);
-            insert_head(cur);
-            cache->hits++;
-            char *val = strdup(cur->value);
-            pthread_mutex_unlock(&cache->mu);
-            return val;
+static void fill_entry(entry_t *e, slab_h self, const char *key, size_t klen, const char *value, size_t vlen,
+                       unsigned long hash, int cls, uint64_t expires_at) {
+    memset(e, 0, ENTRY_HEADER);
+    e->hash = hash;
+    e->klen = (uint16_t)klen;
+    e->vlen = (uint32_t)vlen;
+    e->self = self;
+    e->slab_cls = (unsigned char)cls;
+    e->expires_at = expires_at;
+    atomic_init(&e->refs, 1);
+    memcpy(e->data, key, klen);
+    memcpy(e->data + klen, value, vlen);
+    e->data[klen + vlen] = '\0'; /* for callers that print it; the value may hold NULs too */
+}
+
+/* compressed entries on the lists, for the stats */
+static void z_link(shard_t *s, const entry_t *e) {
+    uint32_t ulen = entry_ulen(e);
+    if (!ulen) return;
+    s->z_items++;
+    s->z_raw += ulen;
+    s->z_stored += e->vlen;
+}
+
+static void z_unlink(shard_t *s, const entry_t *e) {
+    uint32_t ulen = entry_ulen(e);
+    if (!ulen) return;
+    s->z_items--;
+    s->z_raw -= ulen;
+    s->z_stored -= e->vlen;
+}
+
+static void detach_lru(shard_t *s, entry_t *e) {
+    if (!e) return;
+    lru_list_t *l = &s->lists[entry_queue(e)];
+    entry_t *prev = ent(s, e->prev), *next = ent(s, e->next);
+    if (s->hand == e) s->hand = prev;
+    if (prev) prev->next = e->next;
+    else l->head = next;
+    if (next) next->prev = e->prev;
+    else l->tail = prev;
+    e->prev = e->next = 0;
+    l->size--;
+    l->bytes -= entry_charge(s, e);
+    z_unlink(s, e);
+}
+
+static void insert_head(shard_t *s, int q, entry_t *e) {
+    lru_list_t *l = &s->lists[q];
+    entry_set_flags(e, (unsigned)q, E_QUEUE);
+    e->prev = 0;
+    e->next = l->head ? l->head->self : 0;
+    if (l->head) l->head->prev = e->self;
+    l->head = e;
+    if (!l->tail) l->tail = e;
+    l->size++;
+    l->bytes += entry_charge(s, e);
+    z_link(s, e);
+}
+
+/* put n at o's list position (CLOCK and S3FIFO keep insertion order on update) */
+static void replace_lru(shard_t *s, entry_t *o, entry_t *n) {
+    lru_list_t *l = &s->lists[entry_queue(o)];
+    entry_t *prev = ent(s, o->prev), *next = ent(s, o->next);
+    entry_set_flags(n, (unsigned)entry_queue(o), E_QUEUE);
+    n->prev = o->prev;
+    n->next = o->next;
+    if (prev) prev->next = n->self;
+    else l->head = n;
+    if (next) next->prev = n->self;
+    else l->tail = n;
+    if (s->hand == o) s->hand = n;
+    o->prev = o->next = 0;
+    l->bytes += entry_charge(s, n) - entry_charge(s, o);
+    z_unlink(s, o);
+    z_link(s, n);
+}
+
+static size_t shard_bytes(const shard_t *s) {
+    return s->lists[Q_WINDOW].bytes + s->lists[Q_MAIN].bytes;
+}
+
+static int shard_over(const shard_t *s) {
+    return (s->capacity && s->size > s->capacity) || (s->bytes_cap && shard_bytes(s) > s->bytes_cap);
+}
+
+/* is queue q (holding more than one entry) above q0_pct of the shard's limits? */
+static int queue_over(const shard_t *s, int q) {
+    const lru_list_t *l = &s->lists[q];
+    if (l->size <= 1) return 0;
+    return (s->capacity && l->size * 100 > s->capacity * s->q0_pct) ||
+           (s->bytes_cap && l->bytes * 100 > s->bytes_cap * s->q0_pct);
+}
+
+/* queue an unlinked entry for freeing once readers have moved on */
+static void retire(shard_t *s, entry_t *e) {
+    entry_set_flags(e, 0, E_LINKED);
+    e->retire_epoch = epoch_now();
+    e->rnext = 0;
+    if (s->retired_tail) s->retired_tail->rnext = e->self;
+    else s->retired_head = e;
+    s->retired_tail = e;
+}
+
+/* apply buffered hits to the LRU list; caller holds s->mu */
+static void drain_read_buffers(shard_t *s) {
+    for (int i = 0; i < READ_BUF_STRIPES; ++i) {
+        read_buf_t *b = &s->rbuf[i];
+        unsigned long tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+        unsigned long head = atomic_load_explicit(&b->head, memory_order_acquire);
+        for (; tail != head; ++tail) {
+            entry_t *e = atomic_exchange_explicit(&b->slots[tail & (READ_BUF_SIZE - 1)], NULL,
+                                                  memory_order_acquire);
+            if (!e) break; /* claimed but not yet written; pick it up next time */
+            /* the entry may have been replaced or evicted since the hit */
+            if (!(entry_flags(e) & E_LINKED)) continue;
+            if (cache->policy == CACHE_POLICY_TINYLFU) sketch_increment(&s->sketch, e->hash);
+            int q = entry_queue(e);
+            detach_lru(s, e);
+            insert_head(s, q, e);
         }
-        cur = cur->hnext;
+        atomic_store_explicit(&b->tail, tail, memory_order_release);
+    }
+}
+
+/* move up to budget slots of the table being replaced into the current
+   one; retire the old table once it is empty. Caller holds s->mu. */
+static void index_migrate(shard_t *s, size_t budget) {
+    index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed);
+    index_t *old = atomic_load_explicit(&ix->prev, memory_order_relaxed);
+    if (!old) return;
+    size_t nslots = old->mask + 1;
+    while (old->moved < nslots && budget--) {
+        size_t i = old->moved++;
+        if (old->ctrl[i] & 0x80) continue;
+        /* insert before erase, see index_lookup */
+        index_insert(ix, atomic_load_explicit(&old->slots[i], memory_order_relaxed));
+        index_erase(old, i);
+    }
+    if (old->moved < nslots) return;
+    atomic_store_explicit(&ix->prev, NULL, memory_order_release);
+    old->retire_epoch = epoch_now();
+    old->rnext = s->retired_index;
+    s->retired_index = old;
+}
+
+/* publish an empty table of nslots that later writes move the current
+   one into; caller holds s->mu and no move is in progress */
+static int index_start_move(shard_t *s, size_t nslots) {
+    index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed);
+    index_t *nix = index_new(nslots, s->node);
+    if (!nix) return -1;
+    atomic_init(&nix->prev, ix);
+    atomic_store_explicit(&ix->next, nix, memory_order_release);
+    atomic_store_explicit(&s->index, nix, memory_order_release);
+    return 0;
+}
+
+/* make room for one more key. Past 7/8 load (tombstones and entries still
+   to move in included) publish a fresh table, doubled if live entries need
+   it or the same size if tombstones are the problem, and let later writes
+   move the entries over. -1 if there is no room yet. */
+static int index_reserve(shard_t *s) {
+    index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed);
+    index_t *old = atomic_load_explicit(&ix->prev, memory_order_relaxed);
+    size_t nslots = ix->mask + 1;
+    size_t live = ix->used + (old ? old->used : 0);
+    if ((live + ix->tombstones + 1) * 8 <= nslots * 7) return 0;
+    if (old) {
+        /* writes move groups far faster than they fill a table, so this
+           takes a shrink (cache_resize) that sized the table for fewer keys
+           than then came. Only one move runs at a time: hurry this one by
+           another batch, and until it is done turn the key away (the put
+           is dropped like any uncacheable value) rather than move it all
+           in one lock hold. */
+        index_migrate(s, MIGRATE_SLOTS);
+        if (atomic_load_explicit(&ix->prev, memory_order_relaxed)) return -1;
+    }
+    if ((ix->used + ix->tombstones + 1) * 8 <= nslots * 7) return 0;
+    if ((ix->used + 1) * 16 > nslots * 7) nslots <<= 1;
+    return index_start_move(s, nslots);
+}
+
+/* maintenance step; caller holds s->mu. The epoch is read before the
+   buffers are drained: any reader that could still hold a retired entry had
+   pushed it before leaving its epoch, so the drain below sees that pointer
+   while the entry is still allocated. */
+static void maintain(shard_t *s) {
+    int pending = s->retired_head || s->retired_index;
+    uint64_t now = pending ? epoch_try_advance() : 0;
+    drain_read_buffers(s);
+    index_migrate(s, MIGRATE_SLOTS);
+    slab_h o = atomic_exchange_explicit(&s->orphans, 0, memory_order_acquire);
+    while (o) {
+        entry_t *e = ent(s, o);
+        o = e->rnext;
+        free_entry(s, e);
+    }
+    if (!pending) return;
+    while (s->retired_head && epoch_reclaimable(s->retired_head->retire_epoch, now)) {
+        entry_t *e = s->retired_head;
+        s->retired_head = ent(s, e->rnext);
+        /* no reader can take a new count now; one still holding a value frees it */
+        if (atomic_fetch_sub_explicit(&e->refs, 1, memory_order_acq_rel) == 1) free_entry(s, e);
+    }
+    if (!s->retired_head) s->retired_tail = NULL;
+    /* tables retire rarely; a short list scanned in full is fine */
+    for (index_t **pp = &s->retired_index; *pp;) {
+        index_t *ix = *pp;
+        if (epoch_reclaimable(ix->retire_epoch, now)) { *pp = ix->rnext; index_free(ix); }
+        else pp = &ix->rnext;
+    }
+}
+
+
+/* record a hit without locking; returns non-zero if the stripe wants draining.
+   A full or contended buffer simply drops the promotion. */
+static int record_read(read_buf_t *b, entry_t *e) {
+    unsigned long head = atomic_load_explicit(&b->head, memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&b->tail, memory_order_acquire);
+    unsigned long pending = head - tail;
+    if (pending >= READ_BUF_SIZE) return 1;
+    if (!atomic_compare_exchange_strong_explicit(&b->head, &head, head + 1,
+                                                 memory_order_relaxed, memory_order_relaxed))
+        return 0;
+    atomic_store_explicit(&b->slots[head & (READ_BUF_SIZE - 1)], e, memory_order_release);
+    return pending + 1 >= READ_BUF_SIZE / 2;
+}
+
+
+/* advance the CLOCK hand to the first entry without its reference bit.
+   Bounded to two sweeps so concurrent hits cannot keep it going forever. */
+static entry_t *clock_victim(shard_t *s) {
+    lru_list_t *l = &s->lists[Q_WINDOW];
+    entry_t *e = s->hand ? s->hand : l->tail;
+    for (size_t n = 2 * s->size; n > 0; --n) {
+        if (!atomic_load_explicit(&e->freq, memory_order_relaxed)) break;
+        atomic_store_explicit(&e->freq, 0, memory_order_relaxed);
+        e = e->prev ? ent(s, e->prev) : l->tail;
     }
-    cache->misses++;
-    pthread_mutex_unlock(&cache->mu);
+    s->hand = e;
+    return e;
+}
+
+static void wheel_add(shard_t *s, entry_t *e) {
+    wheel_t *w = &s->wheel;
+    /* round up: an entry is only due once its whole deadline has passed */
+    uint64_t t = (e->expires_at + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    uint64_t delta = t > w->tick ? t - w->tick : 0;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+        t = w->tick + delta;
+    }
+    if (t < w->tick) t = w->tick; /* overdue: first slot processed */
+    int l = 0;
+    while (l < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (l + 1)))) ++l;
+    int i = (int)((t >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1));
+    e->wnext = w->slots[l][i];
+    e->wprev = 0;
+    if (e->wnext) ent(s, e->wnext)->wprev = e->self;
+    w->slots[l][i] = e->self;
+    e->wslot = (unsigned char)(l << WHEEL_BITS | i);
+    entry_set_flags(e, E_WHEEL, 0);
+    w->count++;
+}
+
+static void wheel_del(shard_t *s, entry_t *e) {
+    wheel_t *w = &s->wheel;
+    if (!(entry_flags(e) & E_WHEEL)) return;
+    if (e->wprev) ent(s, e->wprev)->wnext = e->wnext;
+    else w->slots[e->wslot >> WHEEL_BITS][e->wslot & (WHEEL_SLOTS - 1)] = e->wnext;
+    if (e->wnext) ent(s, e->wnext)->wprev = e->wprev;
+    e->wnext = e->wprev = 0;
+    entry_set_flags(e, 0, E_WHEEL);
+    w->count--;
+}
+
+/* move one higher-level slot down to where its entries now belong;
+   returns the slot index so the caller knows whether that level wrapped */
+static int wheel_cascade(shard_t *s, int l) {
+    wheel_t *w = &s->wheel;
+    int idx = (int)((w->tick >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1));
+    slab_h h = w->slots[l][idx];
+    w->slots[l][idx] = 0;
+    while (h) {
+        entry_t *e = ent(s, h);
+        h = e->wnext;
+        entry_set_flags(e, 0, E_WHEEL);
+        w->count--;
+        wheel_add(s, e);
+    }
+    return idx;
+}
+
+static void evict_entry(shard_t *s, entry_t *e);
+
+/* expire everything due up to now; caller holds s->mu */
+static void wheel_advance(shard_t *s, uint64_t now) {
+    wheel_t *w = &s->wheel;
+    uint64_t target = now / WHEEL_TICK_MS;
+    if (!w->count) {
+        /* nothing to expire: jump instead of walking empty ticks */
+        if (w->tick <= target) w->tick = target + 1;
+        return;
+    }
+    while (w->tick <= target) {
+        int idx = (int)(w->tick & (WHEEL_SLOTS - 1));
+        if (!idx) {
+            for (int l = 1; l < WHEEL_LEVELS && wheel_cascade(s, l) == 0; ++l)
+                ;
+        }
+        slab_h h;
+        while ((h = w->slots[0][idx])) {
+            entry_t *e = ent(s, h);
+            if (!(entry_flags(e) & E_NEGATIVE)) s->expired++;
+            evict_entry(s, e); /* unlinks it from the wheel too */
+        }
+        w->tick++;
+    }
+}
+
+static void evict_entry(shard_t *s, entry_t *e) {
+    wheel_del(s, e);
+    /* remove from index */
+    index_remove_entry(s, e);
+    /* remove from lru */
+    detach_lru(s, e);
+    retire(s, e);
+    if (!(entry_flags(e) & E_NEGATIVE)) s->size--;
+}
+
+/* evict e to make room */
+static void evict_victim(shard_t *s, entry_t *e) {
+    s->evicted++;
+    evict_entry(s, e);
+}
+
+/* W-TinyLFU: move window overflow into the main LRU, letting each candidate
+   in only if it is more popular than the entry it would push out */
+static void tinylfu_admit(shard_t *s) {
+    lru_list_t *win = &s->lists[Q_WINDOW], *main = &s->lists[Q_MAIN];
+    while (queue_over(s, Q_WINDOW)) {
+        entry_t *cand = win->tail;
+        /* a large candidate may need several victims to fit; each is compared in turn */
+        if (shard_over(s) && main->tail) {
+            entry_t *victim = main->tail;
+            if (sketch_freq(&s->sketch, cand->hash) <= sketch_freq(&s->sketch, victim->hash)) {
+                evict_victim(s, cand);
+                continue;
+            }
+            evict_victim(s, victim);
+        }
+        detach_lru(s, cand);
+        insert_head(s, Q_MAIN, cand);
+    }
+}
+
+/* S3FIFO: evict one entry, promoting or reinserting hit entries on the way */
+static void s3fifo_evict_one(shard_t *s) {
+    lru_list_t *small = &s->lists[Q_SMALL], *main = &s->lists[Q_MAIN];
+    for (;;) {
+        if (small->tail && (queue_over(s, Q_SMALL) || !main->tail)) {
+            entry_t *e = small->tail;
+            if (atomic_load_explicit(&e->freq, memory_order_relaxed)) {
+                atomic_store_explicit(&e->freq, 0, memory_order_relaxed);
+                detach_lru(s, e);
+                insert_head(s, Q_MAIN, e);
+                continue;
+            }
+            ghost_add(&s->ghost, e->hash);
+            evict_victim(s, e);
+            return;
+        }
+        if (!main->tail) return;
+        entry_t *e = main->tail;
+        unsigned char f = atomic_load_explicit(&e->freq, memory_order_relaxed);
+        if (f) {
+            atomic_store_explicit(&e->freq, f - 1, memory_order_relaxed);
+            detach_lru(s, e);
+            insert_head(s, Q_MAIN, e);
+            continue;
+        }
+        evict_victim(s, e);
+        return;
+    }
+}
+
+static void evict_if_needed(shard_t *s) {
+    if (cache->policy == CACHE_POLICY_TINYLFU) tinylfu_admit(s);
+    if (cache->policy == CACHE_POLICY_S3FIFO) {
+        while (shard_over(s) && s->size) s3fifo_evict_one(s);
+        return;
+    }
+    while (shard_over(s)) {
+        entry_t *e;
+        if (cache->policy == CACHE_POLICY_CLOCK) e = clock_victim(s);
+        else e = s->lists[Q_MAIN].tail ? s->lists[Q_MAIN].tail : s->lists[Q_WINDOW].tail;
+        if (!e) break;
+        evict_victim(s, e);
+    }
+}
+
+/* move the shard to the node whose threads read it most lately; ticker only */
+static void numa_check(shard_t *s) {
+    unsigned long delta[NUMA_MAX_NODES];
+    for (int n = 0; n < cache->numa_nodes; ++n) {
+        unsigned long total = 0;
+        for (int j = 0; j < READ_BUF_STRIPES; ++j)
+            total += atomic_load_explicit(&s->rbuf[j].node_reads[n], memory_order_relaxed);
+        delta[n] = total - s->node_seen[n];
+        s->node_seen[n] = total;
+    }
+    /* all of delta is filled in before comparing against the home node's */
+    int best = s->node;
+    for (int n = 0; n < cache->numa_nodes; ++n)
+        if (delta[n] > delta[best]) best = n;
+    if (best == s->node || delta[best] < NUMA_MIN_READS || delta[best] <= 2 * delta[s->node]) return;
+    /* writers wait while the pages move; lock-free readers keep going */
+    pthread_mutex_lock(&s->mu);
+    slab_move(&s->slab, best);
+    for (index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed); ix;
+         ix = atomic_load_explicit(&ix->prev, memory_order_relaxed))
+        if (ix->map_len) numa_mem_move(ix->ctrl, ix->map_len, best);
+    __atomic_store_n(&s->node, best, __ATOMIC_RELAXED);
+    s->numa_moves++;
+    pthread_mutex_unlock(&s->mu);
+}
+
+/* background thread: turns every shard's wheel once per tick, and runs the
+   usual maintenance so shards that only see reads still free retired entries */
+static void *ticker_main(void *arg) {
+    (void)arg;
+    unsigned long ticks = 0;
+    pthread_mutex_lock(&cache->ticker_mu);
+    while (!cache->ticker_stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += WHEEL_TICK_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+        pthread_cond_timedwait(&cache->ticker_cv, &cache->ticker_mu, &ts);
+        if (cache->ticker_stop) break;
+        pthread_mutex_unlock(&cache->ticker_mu);
+        unsigned long evicted = 0, expired = 0;
+        for (size_t i = 0; i < cache->nshards; ++i) {
+            shard_t *s = &cache->shards[i];
+            pthread_mutex_lock(&s->mu);
+            maintain(s);
+            wheel_advance(s, now_ms());
+            evicted += s->evicted;
+            expired += s->expired;
+            pthread_mutex_unlock(&s->mu);
+        }
+        if (cache->numa_nodes > 1 && ++ticks % NUMA_CHECK_TICKS == 0)
+            for (size_t i = 0; i < cache->nshards; ++i) numa_check(&cache->shards[i]);
+        pthread_mutex_lock(&cache->ticker_mu);
+        uint64_t now = now_ms();
+        if (now - cache->hist_at >= CACHE_DEBUG_INTERVAL_S * 1000) {
+            cache->evict_hist[cache->hist_pos] = evicted - cache->hist_evicted;
+            cache->expire_hist[cache->hist_pos] = expired - cache->hist_expired;
+            cache->hist_pos = (cache->hist_pos + 1) % CACHE_DEBUG_HISTORY;
+            if (cache->hist_len < CACHE_DEBUG_HISTORY) cache->hist_len++;
+            cache->hist_at = now;
+            cache->hist_evicted = evicted;
+            cache->hist_expired = expired;
+        }
+    }
+    pthread_mutex_unlock(&cache->ticker_mu);
+    return NULL;
+}
+
+/* hand a key to the refresher; with the queue full the entry's flag is
+   cleared again so a later read can retry */
+static void refresh_enqueue(const cache_key_t *key) {
+    char *copy = malloc(key->len + 1);
+    int queued = 0;
+    pthread_mutex_lock(&cache->refresh_mu);
+    if (copy && cache->refresh_len < REFRESH_QUEUE) {
+        memcpy(copy, key->str, key->len + 1);
+        cache_key_t *k = &cache->refresh_q[(cache->refresh_head + cache->refresh_len++) % REFRESH_QUEUE];
+        k->str = copy;
+        k->len = key->len;
+        k->hash = key->hash;
+        cache->refreshes++;
+        pthread_cond_signal(&cache->refresh_cv);
+        queued = 1;
+    } else {
+        cache->refresh_dropped++;
+    }
+    pthread_mutex_unlock(&cache->refresh_mu);
+    if (!queued) {
+        free(copy);
+        refresh_abandon(key);
+    }
+}
+
+static void *refresher_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&cache->refresh_mu);
+    while (!cache->refresh_stop) {
+        if (!cache->refresh_len) {
+            pthread_cond_wait(&cache->refresh_cv, &cache->refresh_mu);
+            continue;
+        }
+        cache_key_t k = cache->refresh_q[cache->refresh_head];
+        cache->refresh_head = (cache->refresh_head + 1) % REFRESH_QUEUE;
+        cache->refresh_len--;
+        pthread_mutex_unlock(&cache->refresh_mu);
+        /* a failed reload leaves the old value to be served and retried */
+        if (cache->refresh(&k) != 0) refresh_abandon(&k);
+        free((char *)k.str);
+        pthread_mutex_lock(&cache->refresh_mu);
+    }
+    pthread_mutex_unlock(&cache->refresh_mu);
     return NULL;
 }
 
-int cache_put(const char *key, const char *value) {
+static void l1_drop(l1_val_t *v) {
+    if (!v) return;
+    if (v->pins) v->detached = 1;
+    else free(v);
+}
+
+/* thread exit: take its near-cache off the list (one from an earlier
+   cache_init is gone already); copies still pinned go when released */
+static void l1_exit(void *p) {
+    (void)p;
+    l1_t *l = my_l1;
+    my_l1 = NULL;
+    if (!l || !cache || my_l1_gen != cache->gen) return;
+    pthread_mutex_lock(&cache->l1_mu);
+    l1_t **lp = &cache->l1_list;
+    while (*lp != l) lp = &(*lp)->next;
+    *lp = l->next;
+    cache->l1_gone_hits += atomic_load_explicit(&l->hits, memory_order_relaxed);
+    pthread_mutex_unlock(&cache->l1_mu);
+    for (size_t i = 0; i < cache->l1_slots; ++i) l1_drop(l->slots[i].val);
+    free(l);
+}
+
+static void make_l1_exit_key(void) {
+    pthread_key_create(&l1_exit_key, l1_exit);
+}
+
+/* the calling thread's near-cache, made on first use; NULL if out of memory */
+static l1_t *l1_self(void) {
+    if (my_l1 && my_l1_gen == cache->gen) return my_l1;
+    pthread_once(&l1_exit_once, make_l1_exit_key);
+    l1_t *l = calloc(1, sizeof(l1_t) + cache->l1_slots * sizeof(l1_slot_t));
+    if (!l) return NULL;
+    pthread_mutex_lock(&cache->l1_mu);
+    l->next = cache->l1_list;
+    cache->l1_list = l;
+    pthread_mutex_unlock(&cache->l1_mu);
+    my_l1 = l;
+    my_l1_gen = cache->gen;
+    pthread_setspecific(l1_exit_key, l);
+    return l;
+}
+
+/* serve key from the slot if its copy is still current */
+static int l1_hit(l1_slot_t *ls, const cache_key_t *key, unsigned long ep, cache_value_t *out) {
+    l1_val_t *v = ls->val;
+    if (!v || ls->hash != key->hash || ls->epoch != ep || v->klen != key->len ||
+        memcmp(v->data, key->str, key->len) != 0)
+        return 0;
+    if (v->expires_at || v->refresh_at) {
+        uint64_t now = now_ms();
+        /* let the shard see deadlines (and queue refreshes) */
+        if ((v->expires_at && now >= v->expires_at) || (v->refresh_at && now >= v->refresh_at)) return 0;
+    }
+    if ((++ls->uses & (L1_RECHECK - 1)) == 0) return 0;
+    v->pins++;
+    out->data = v->data + v->klen + 1;
+    out->len = v->vlen;
+    out->ref = (void *)((uintptr_t)v | 1);
+    return 1;
+}
+
+/* a private copy of e's key with room for a vlen byte value, which the
+   caller fills in */
+static l1_val_t *val_new(const entry_t *e, size_t vlen) {
+    l1_val_t *v = malloc(sizeof(*v) + e->klen + vlen + 2);
+    if (!v) return NULL;
+    v->pins = 0;
+    v->detached = 0;
+    v->klen = e->klen;
+    v->vlen = vlen;
+    v->expires_at = e->expires_at;
+    v->refresh_at = e->refresh_at;
+    memcpy(v->data, e->data, e->klen);
+    v->data[e->klen] = '\0';
+    v->data[e->klen + 1 + vlen] = '\0';
+    return v;
+}
+
+/* e's value decoded into a private copy (inside the epoch); NULL if out of memory */
+static l1_val_t *val_unzip(const entry_t *e, read_buf_t *b) {
+    uint32_t ulen = entry_ulen(e);
+    l1_val_t *v = val_new(e, ulen);
+    if (!v) return NULL;
+    /* timing every decode would cost a good part of a small one */
+    int timed = (my_unzips++ & (UNZIP_SAMPLE - 1)) == 0;
+    uint64_t t0 = timed ? now_ns() : 0;
+    if (lz_decompress(entry_value(e) + sizeof(ulen), e->vlen - sizeof(ulen), v->data + e->klen + 1, ulen) != 0) {
+        free(v); /* only a damaged entry gets here */
+        return NULL;
+    }
+    if (timed) atomic_fetch_add_explicit(&b->unzip_ns, (now_ns() - t0) * UNZIP_SAMPLE, memory_order_relaxed);
+    atomic_fetch_add_explicit(&b->unzips, 1, memory_order_relaxed);
+    return v;
+}
+
+/* after a shard hit on e (inside the epoch), whose value reads as value:
+   copy it into the slot if the key missed there just before, or note it
+   as the slot's candidate */
+static void l1_fill(l1_slot_t *ls, const cache_key_t *key, const entry_t *e, const char *value, size_t vlen,
+                    unsigned long ep) {
+    l1_val_t *old = ls->val;
+    /* the copy still matches (compared by content: a freed entry's chunk
+       can come back for the same key with another value) */
+    if (old && ls->hash == key->hash && old->klen == e->klen && old->vlen == vlen &&
+        old->expires_at == e->expires_at && old->refresh_at == e->refresh_at &&
+        memcmp(old->data, e->data, e->klen) == 0 && memcmp(old->data + e->klen + 1, value, vlen) == 0) {
+        ls->epoch = ep;
+        return;
+    }
+    if (ls->cand != key->hash) {
+        ls->cand = key->hash;
+        return;
+    }
+    if (vlen > L1_MAX_VALUE) return;
+    l1_val_t *v = val_new(e, vlen);
+    if (!v) return;
+    memcpy(v->data + e->klen + 1, value, vlen);
+    l1_drop(old);
+    ls->val = v;
+    ls->hash = key->hash;
+    ls->epoch = ep;
+    ls->uses = 0;
+}
+
+/* after a put or delete is visible in the index: near-cache copies of the shard's keys go stale */
+static void l1_invalidate(shard_t *s) {
+    if (cache->l1_slots) atomic_fetch_add_explicit(&s->wepoch, 1, memory_order_release);
+}
+
+void cache_l1_prefer(const cache_key_t *key) {
+    if (!cache || !cache->l1_slots) return;
+    l1_t *l1 = l1_self();
+    if (!l1) return;
+    l1_slot_t *ls = &l1->slots[(key->hash >> 7) & (cache->l1_slots - 1)];
+    /* don't push out a copy that is earning its keep */
+    if (!ls->val || ls->hash == key->hash || !ls->uses) ls->cand = key->hash;
+}
+
+int cache_get(const cache_key_t *key, cache_value_t *out) {
     if (!cache) return -1;
-    pthread_mutex_lock(&cache->mu);
-    unsigned long h = hash_fn(key) % cache->nbuckets;
-    entry_t *cur = cache->buckets[h];
-    while (cur) {
-        if (strcmp(cur->key, key) == 0) {
-            /* update existing */
-            free(cur->value);
-            cur->value = strdup(value);
-            cur->vlen = strlen(value);
-            detach_lru(cur);
-            insert_head(cur);
-            pthread_mutex_unlock(&cache->mu);
+    shard_t *s = shard_for(key->hash);
+    l1_t *l1 = NULL;
+    l1_slot_t *ls = NULL;
+    unsigned long ep = 0;
+    if (cache->l1_slots && (l1 = l1_self())) {
+        ls = &l1->slots[(key->hash >> 7) & (cache->l1_slots - 1)];
+        /* read before the lookup: a put racing with it makes the copy look stale, never fresh */
+        ep = atomic_load_explicit(&s->wepoch, memory_order_acquire);
+        if (l1_hit(ls, key, ep, out)) {
+            atomic_store_explicit(&l1->hits, atomic_load_explicit(&l1->hits, memory_order_relaxed) + 1,
+                                  memory_order_relaxed);
             return 0;
         }
-        cur = cur->hnext;
-    }
-    /* create new entry */
-    entry_t *e = calloc(1, sizeof(entry_t));
-    if (!e) { pthread_mutex_unlock(&cache->mu); return -1; }
-    e->key = strdup(key);
-    e->value = strdup(value);
-    e->klen = strlen(e->key);
-    e->vlen = strlen(e->value);
-    /* insert into hash bucket */
-    e->hnext = cache->buckets[h];
-    cache->buckets[h] = e;
-    /* insert at head */
-    insert_head(e);
-    cache->size++;
+    }
+    read_buf_t *b = stripe_for(s);
+    int want_drain = 0;
+
+    if (cache->numa_nodes) {
+        int here = numa_this_node();
+        atomic_fetch_add_explicit(&b->node_reads[here], 1, memory_order_relaxed);
+        /* s->node changes only on a move; a stale read miscounts one lookup */
+        if (here == __atomic_load_n(&s->node, __ATOMIC_RELAXED))
+            atomic_fetch_add_explicit(&b->numa_local, 1, memory_order_relaxed);
+        else
+            atomic_fetch_add_explicit(&b->numa_remote, 1, memory_order_relaxed);
+    }
+
+    epoch_enter();
+    entry_t *cur = index_lookup(s, key);
+    uint64_t now = cur && (cur->expires_at || cur->refresh_at) ? now_ms() : 0;
+    /* past its deadline it is gone, whether or not the wheel got to it yet */
+    if (cur && cur->expires_at && now >= cur->expires_at) cur = NULL;
+    unsigned flags = cur ? entry_flags(cur) : 0;
+    int negative = (flags & E_NEGATIVE) != 0;
+    int stale = 0, want_refresh = 0;
+    if (cur && cur->refresh_at && now >= cur->refresh_at) {
+        /* still served; the first reader to get here queues the reload */
+        stale = 1;
+        unsigned char zero = 0;
+        want_refresh = !atomic_load_explicit(&cur->refreshing, memory_order_relaxed) &&
+                       atomic_compare_exchange_strong_explicit(&cur->refreshing, &zero, 1,
+                                                               memory_order_relaxed, memory_order_relaxed);
+    }
+    if (negative) {
+        cur = NULL; /* nothing to hand out, and not worth promoting */
+    } else if (flags & E_COMPRESSED) {
+        /* compressed: the reader gets its own decoded copy */
+        l1_val_t *v = val_unzip(cur, b);
+        if (v) {
+            v->pins = 1;
+            v->detached = 1;
+            out->data = v->data + v->klen + 1;
+            out->len = v->vlen;
+            out->ref = (void *)((uintptr_t)v | 1);
+        } else {
+            cur = NULL;
+        }
+    } else if (cur) {
+        /* the cache's own count can't drop while we are inside the epoch */
+        atomic_fetch_add_explicit(&cur->refs, 1, memory_order_relaxed);
+        out->data = entry_value(cur);
+        out->len = cur->vlen;
+        out->ref = cur;
+    }
+    if (cur) {
+        if (ls && !stale) l1_fill(ls, key, cur, out->data, out->len, ep);
+        if (cache->policy == CACHE_POLICY_CLOCK || cache->policy == CACHE_POLICY_S3FIFO) {
+            /* read first so a hot entry's line is not written on every hit;
+               a lost racing increment only makes the counter a bit low */
+            unsigned char f = atomic_load_explicit(&cur->freq, memory_order_relaxed);
+            unsigned char max = cache->policy == CACHE_POLICY_CLOCK ? 1 : S3FIFO_MAX_FREQ;
+            if (f < max) atomic_store_explicit(&cur->freq, f + 1, memory_order_relaxed);
+        } else {
+            want_drain = record_read(b, cur);
+        }
+    }
+    epoch_exit();
+
+    if (cur) atomic_fetch_add_explicit(&b->hits, 1, memory_order_relaxed);
+    else if (negative) atomic_fetch_add_explicit(&b->neg_hits, 1, memory_order_relaxed);
+    else atomic_fetch_add_explicit(&b->misses, 1, memory_order_relaxed);
+    if (stale) atomic_fetch_add_explicit(&b->stale_hits, 1, memory_order_relaxed);
+    if (want_refresh) refresh_enqueue(key);
+
+    /* help with maintenance only if nobody holds the lock: never block a reader */
+    if (want_drain && pthread_mutex_trylock(&s->mu) == 0) {
+        maintain(s);
+        pthread_mutex_unlock(&s->mu);
+    }
+    return cur ? 0 : negative ? CACHE_NEGATIVE : -1;
+}
+
+void cache_value_release(cache_value_t *v) {
+    entry_t *e = v->ref;
+    if (!e) return;
+    v->ref = NULL;
+    if ((uintptr_t)e & 1) {
+        /* a near-cache copy, private to this thread */
+        l1_val_t *lv = (l1_val_t *)((uintptr_t)e & ~(uintptr_t)1);
+        if (--lv->pins == 0 && lv->detached) free(lv);
+        return;
+    }
+    if (atomic_fetch_sub_explicit(&e->refs, 1, memory_order_acq_rel) != 1) return;
+    /* last holder of a retired entry: the slab may only be touched under
+       the shard lock, so hand it to the next maintain() */
+    shard_t *s = shard_for(e->hash);
+    e->rnext = atomic_load_explicit(&s->orphans, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&s->orphans, &e->rnext, e->self, memory_order_release,
+                                                  memory_order_relaxed))
+        ;
+}
+
+int cache_put(const cache_key_t *key, const char *value, size_t len) {
+    return cache_put_ttl(key, value, len, 0);
+}
+
+/* put_entry only touches an existing entry, and only while its refresh is pending */
+#define PUT_REFRESHED 1
+
+static int put_entry(const cache_key_t *key, const char *value, size_t vlen, unsigned long ttl_ms, int flags) {
+    if (!cache) return -1;
+    uint64_t now = now_ms();
+    uint64_t expires_at = ttl_ms ? now + ttl_ms : 0;
+    uint64_t refresh_at = 0;
+    if (cache->refresh_ms) {
+        refresh_at = now + cache->refresh_ms;
+        /* the staleness bound: unread past it, the entry just goes */
+        uint64_t bound = cache->stale_ms ? refresh_at + cache->stale_ms : 0;
+        if (bound && (!expires_at || bound < expires_at)) expires_at = bound;
+    }
+    unsigned long hv = key->hash;
+    shard_t *s = shard_for(hv);
+    size_t klen = key->len;
+    /* compressed before the lock, behind its decoded length; output past
+       7/8 of the input gives up early */
+    char *zbuf = NULL;
+    uint32_t ulen = 0;
+    uint64_t zns = 0;
+    size_t zcap = vlen - vlen / 8;
+    if (cache->compress_min && vlen >= cache->compress_min && vlen <= 0xffffffffu && zcap > sizeof(ulen) &&
+        (zbuf = malloc(zcap))) {
+        uint64_t t0 = now_ns();
+        size_t zlen = lz_compress(value, vlen, zbuf + sizeof(ulen), zcap - sizeof(ulen));
+        zns = now_ns() - t0;
+        if (zlen) {
+            ulen = (uint32_t)vlen;
+            memcpy(zbuf, &ulen, sizeof(ulen));
+            value = zbuf;
+            vlen = sizeof(ulen) + zlen;
+        }
+    }
+    size_t need = ENTRY_HEADER + klen + vlen + 1;
+    /* the class table is fixed after init, so this needs no lock */
+    int cls = slab_class_for(&s->slab, need);
+    size_t alloc = slab_alloc_size(&s->slab, cls, need);
+    /* an entry bigger than the whole shard budget is not cached, nor is a
+       key past what the header can hold */
+    size_t bytes_cap = __atomic_load_n(&s->bytes_cap, __ATOMIC_RELAXED); /* cache_resize may change it */
+    int too_big = (bytes_cap && alloc > bytes_cap) || alloc > 0xffffffffu || klen > UINT16_MAX;
+    entry_t *e = NULL;
+    if (!too_big && cls == SLAB_LARGE) {
+        /* large values are copied before taking the lock */
+        e = malloc(alloc);
+        if (e) fill_entry(e, 0, key->str, klen, value, vlen, hv, cls, expires_at);
+    }
+    pthread_mutex_lock(&s->mu);
+    maintain(s);
+    if (!too_big && cls != SLAB_LARGE) {
+        slab_h h;
+        e = slab_alloc(&s->slab, cls, &h);
+        if (e) fill_entry(e, h, key->str, klen, value, vlen, hv, cls, expires_at);
+    } else if (e && !(e->self = slab_large_add(&s->slab, e))) {
+        free(e);
+        e = NULL;
+    } else if (e) {
+        s->slab.large_count++;
+        s->slab.large_bytes += alloc;
+    }
+    if (e) {
+        e->refresh_at = refresh_at;
+        if (ulen) entry_set_flags(e, E_COMPRESSED, 0);
+    }
+    if (zbuf) {
+        if (ulen) s->z_puts++;
+        else s->z_skipped++;
+        s->z_ns += zns;
+        free(zbuf);
+    }
+    /* if the new value can't be cached, an older copy must still go so
+       readers don't see a stale value */
+    int drop = e == NULL;
+    if (cache->policy == CACHE_POLICY_TINYLFU) sketch_increment(&s->sketch, hv);
+    entry_t *cur;
+    size_t slot;
+    index_t *ix = index_locate(s, key, &slot, &cur);
+    if ((flags & PUT_REFRESHED) &&
+        (!cur || (entry_flags(cur) & E_NEGATIVE) || !atomic_load_explicit(&cur->refreshing, memory_order_relaxed))) {
+        /* replaced, deleted or evicted since the refresh was queued: that is newer */
+        if (e) free_entry(s, e);
+        pthread_mutex_unlock(&s->mu);
+        return -1;
+    }
+    if (cur && (drop || (entry_flags(cur) & E_NEGATIVE))) {
+        /* a negative entry lives on another list: replace it by a fresh insert */
+        evict_entry(s, cur);
+    } else if (cur) {
+        /* update existing: swap in the new copy in the same slot (same tag) */
+        entry_set_flags(e, E_LINKED, 0);
+        atomic_store_explicit(&ix->slots[slot], e, memory_order_release);
+        if (cache->policy == CACHE_POLICY_CLOCK) {
+            atomic_store_explicit(&e->freq, 1, memory_order_relaxed);
+            replace_lru(s, cur, e);
+        } else if (cache->policy == CACHE_POLICY_S3FIFO) {
+            unsigned char f = atomic_load_explicit(&cur->freq, memory_order_relaxed);
+            atomic_store_explicit(&e->freq, f < S3FIFO_MAX_FREQ ? f + 1 : f, memory_order_relaxed);
+            replace_lru(s, cur, e);
+        } else {
+            int q = entry_queue(cur);
+            detach_lru(s, cur);
+            insert_head(s, q, e);
+        }
+        wheel_del(s, cur);
+        if (e->expires_at) wheel_add(s, e);
+        retire(s, cur);
+        __atomic_store_n(&s->puts, s->puts + 1, __ATOMIC_RELAXED);
+        l1_invalidate(s);
+        /* the new value may be larger than the old one */
+        evict_if_needed(s);
+        pthread_mutex_unlock(&s->mu);
+        return 0;
+    }
+    if (!drop && index_reserve(s) != 0) {
+        free_entry(s, e);
+        drop = 1;
+    }
+    if (drop) {
+        l1_invalidate(s); /* any older copy is gone too */
+        pthread_mutex_unlock(&s->mu);
+        return -1;
+    }
+    /* insert into the index */
+    entry_set_flags(e, E_LINKED, 0);
+    index_insert(atomic_load_explicit(&s->index, memory_order_relaxed), e);
+    /* insert at head (of the admission window for TINYLFU; of main for an
+       S3FIFO ghost hit, of the small queue otherwise) */
+    if (cache->policy == CACHE_POLICY_S3FIFO && ghost_take(&s->ghost, hv)) insert_head(s, Q_MAIN, e);
+    else insert_head(s, Q_WINDOW, e);
+    if (e->expires_at) wheel_add(s, e);
+    s->size++;
+    __atomic_store_n(&s->puts, s->puts + 1, __ATOMIC_RELAXED);
+    l1_invalidate(s);
     /* evict if necessary */
-    evict_if_needed();
-    pthread_mutex_unlock(&cache->mu);
+    evict_if_needed(s);
+    pthread_mutex_unlock(&s->mu);
     return 0;
 }
 
-int cache_delete(const char *key) {
+int cache_put_ttl(const cache_key_t *key, const char *value, size_t len, unsigned long ttl_ms) {
+    return put_entry(key, value, len, ttl_ms, 0);
+}
+
+int cache_put_refreshed(const cache_key_t *key, const char *value, size_t len, unsigned long ttl_ms) {
+    if (value) return put_entry(key, value, len, ttl_ms, PUT_REFRESHED);
     if (!cache) return -1;
-    pthread_mutex_lock(&cache->mu);
-    unsigned long h = hash_fn(key) % cache->nbuckets;
-    entry_t **pp = &cache->buckets[h];
-    while (*pp) {
-        if (strcmp((*pp)->key, key) == 0) {
-            entry_t *found = *pp;
-            *pp = found->hnext;
-            detach_lru(found);
-            free(found->key);
-            free(found->value);
-            free(found);
-            cache->size--;
-            pthread_mutex_unlock(&cache->mu);
-            return 0;
-        }
-        pp = &(*pp)->hnext;
+    /* gone from the store: drop the entry unless something newer replaced it */
+    shard_t *s = shard_for(key->hash);
+    pthread_mutex_lock(&s->mu);
+    entry_t *cur;
+    size_t slot;
+    index_locate(s, key, &slot, &cur);
+    int rc = -1;
+    if (cur && !(entry_flags(cur) & E_NEGATIVE) && atomic_load_explicit(&cur->refreshing, memory_order_relaxed)) {
+        evict_entry(s, cur);
+        l1_invalidate(s);
+        rc = 0;
+    }
+    pthread_mutex_unlock(&s->mu);
+    return rc;
+}
+
+/* remove key's entry, if any; caller holds s->mu */
+static entry_t *delete_locked(shard_t *s, const cache_key_t *key) {
+    entry_t *cur;
+    size_t slot;
+    index_t *ix = index_locate(s, key, &slot, &cur);
+    if (cur) {
+        index_erase(ix, slot);
+        wheel_del(s, cur);
+        detach_lru(s, cur);
+        retire(s, cur);
+        if (!(entry_flags(cur) & E_NEGATIVE)) s->size--;
+    }
+    return cur;
+}
+
+int cache_delete(const cache_key_t *key) {
+    if (!cache) return -1;
+    shard_t *s = shard_for(key->hash);
+    pthread_mutex_lock(&s->mu);
+    maintain(s);
+    entry_t *cur = delete_locked(s, key);
+    /* even with nothing here: a thread may still hold a copy of an evicted value */
+    l1_invalidate(s);
+    pthread_mutex_unlock(&s->mu);
+    return cur ? 0 : -1;
+}
+
+/* slab class for a negative entry of key, or SLAB_LARGE if none is kept */
+static int neg_class(shard_t *s, const cache_key_t *key) {
+    if (!cache->neg_ttl_ms || !s->neg_cap) return SLAB_LARGE;
+    /* a key too long for a slab chunk isn't worth remembering */
+    return slab_class_for(&s->slab, ENTRY_HEADER + key->len + 1);
+}
+
+/* link a negative entry for key, which has no entry; caller holds s->mu */
+static int neg_link(shard_t *s, const cache_key_t *key, int cls, uint64_t now) {
+    slab_h h;
+    entry_t *e = index_reserve(s) == 0 ? slab_alloc(&s->slab, cls, &h) : NULL;
+    if (!e) return -1;
+    fill_entry(e, h, key->str, key->len, "", 0, key->hash, cls, now + cache->neg_ttl_ms);
+    entry_set_flags(e, E_NEGATIVE | E_LINKED, 0);
+    index_insert(atomic_load_explicit(&s->index, memory_order_relaxed), e);
+    insert_head(s, Q_NEG, e);
+    wheel_add(s, e);
+    /* over the limit the oldest go first; with one TTL they are also the next to expire */
+    while (s->lists[Q_NEG].bytes > s->neg_cap) evict_entry(s, s->lists[Q_NEG].tail);
+    return 0;
+}
+
+int cache_put_negative(const cache_key_t *key) {
+    if (!cache) return -1;
+    shard_t *s = shard_for(key->hash);
+    int cls = neg_class(s, key);
+    if (cls == SLAB_LARGE) return -1;
+    uint64_t now = now_ms();
+    pthread_mutex_lock(&s->mu);
+    maintain(s);
+    entry_t *cur;
+    size_t slot;
+    index_locate(s, key, &slot, &cur);
+    if (cur && cur->expires_at && now >= cur->expires_at) {
+        evict_entry(s, cur); /* dead already; the wheel just hasn't got to it */
+        cur = NULL;
+    }
+    if (cur) {
+        /* a value put since the store missed wins; an existing negative entry keeps its deadline */
+        int rc = entry_flags(cur) & E_NEGATIVE ? 0 : -1;
+        pthread_mutex_unlock(&s->mu);
+        return rc;
+    }
+    int rc = neg_link(s, key, cls, now);
+    if (rc == 0) l1_invalidate(s); /* the store lost the key: so must copies of an evicted value */
+    pthread_mutex_unlock(&s->mu);
+    return rc;
+}
+
+unsigned long cache_write_seq(const cache_key_t *key) {
+    if (!cache) return 0;
+    return __atomic_load_n(&shard_for(key->hash)->puts, __ATOMIC_RELAXED);
+}
+
+int cache_delete_negative(const cache_key_t *key, unsigned long seq) {
+    if (!cache) return -1;
+    shard_t *s = shard_for(key->hash);
+    int cls = neg_class(s, key);
+    pthread_mutex_lock(&s->mu);
+    maintain(s);
+    delete_locked(s, key);
+    int rc = -1;
+    /* a put since seq may have written the store after the delete: with no
+       entry, the next read goes to the store and finds out */
+    if (cls != SLAB_LARGE && s->puts == seq) rc = neg_link(s, key, cls, now_ms());
+    l1_invalidate(s);
+    pthread_mutex_unlock(&s->mu);
+    return rc;
+}
+
+static const char *const policy_names[] = {
+    [CACHE_POLICY_LRU] = "lru",
+    [CACHE_POLICY_CLOCK] = "clock",
+    [CACHE_POLICY_TINYLFU] = "tinylfu",
+    [CACHE_POLICY_S3FIFO] = "s3fifo",
+};
+
+int cache_policy_parse(const char *name, cache_policy_t *out) {
+    for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); ++i) {
+        if (strcmp(name, policy_names[i]) == 0) { *out = (cache_policy_t)i; return 0; }
     }
-    pthread_mutex_unlock(&cache->mu);
     return -1;
 }
 
-void cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *items) {
-    if (!cache) { if (hits) *hits = 0; if (misses) *misses = 0; if (items) *items = 0; return; }
-    pthread_mutex_lock(&cache->mu);
-    if (hits) *hits = cache->hits;
-    if (misses) *misses = cache->misses;
-    if (items) *items = cache->size;
-    pthread_mutex_unlock(&cache->mu);
+const char *cache_policy_name(void) {
+    return policy_names[cache ? cache->policy : CACHE_POLICY_LRU];
+}
+
+void cache_stats(cache_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    if (!cache) return;
+    st->policy = cache->policy;
+    pthread_mutex_lock(&cache->refresh_mu);
+    st->refreshes = cache->refreshes;
+    st->refresh_dropped = cache->refresh_dropped;
+    pthread_mutex_unlock(&cache->refresh_mu);
+    st->slab_page_size = SLAB_PAGE_SIZE;
+    st->numa_nodes = cache->numa_nodes;
+    pthread_mutex_lock(&cache->l1_mu);
+    st->l1_hits = cache->l1_gone_hits;
+    for (l1_t *l = cache->l1_list; l; l = l->next)
+        st->l1_hits += atomic_load_explicit(&l->hits, memory_order_relaxed);
+    pthread_mutex_unlock(&cache->l1_mu);
+    st->hits += st->l1_hits;
+    /* one shard at a time: totals are not an atomic snapshot, which is fine for metrics */
+    for (size_t i = 0; i < cache->nshards; ++i) {
+        shard_t *s = &cache->shards[i];
+        for (int j = 0; j < READ_BUF_STRIPES; ++j) {
+            st->hits += atomic_load_explicit(&s->rbuf[j].hits, memory_order_relaxed);
+            st->misses += atomic_load_explicit(&s->rbuf[j].misses, memory_order_relaxed);
+            st->neg_hits += atomic_load_explicit(&s->rbuf[j].neg_hits, memory_order_relaxed);
+            st->stale_hits += atomic_load_explicit(&s->rbuf[j].stale_hits, memory_order_relaxed);
+            st->numa_local += atomic_load_explicit(&s->rbuf[j].numa_local, memory_order_relaxed);
+            st->numa_remote += atomic_load_explicit(&s->rbuf[j].numa_remote, memory_order_relaxed);
+            st->z_decoded += atomic_load_explicit(&s->rbuf[j].unzips, memory_order_relaxed);
+            st->z_decode_ns += atomic_load_explicit(&s->rbuf[j].unzip_ns, memory_order_relaxed);
+        }
+        pthread_mutex_lock(&s->mu);
+        st->numa_moves += s->numa_moves;
+        st->z_items += s->z_items;
+        st->z_raw_bytes += s->z_raw;
+        st->z_bytes += s->z_stored;
+        st->z_compressed += s->z_puts;
+        st->z_skipped += s->z_skipped;
+        st->z_encode_ns += s->z_ns;
+        st->items += s->size;
+        st->expired += s->expired;
+        st->neg_items += s->lists[Q_NEG].size;
+        st->neg_bytes += s->lists[Q_NEG].bytes;
+        st->capacity += s->capacity;
+        st->bytes_used += shard_bytes(s);
+        st->bytes_limit += s->bytes_cap;
+        index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed);
+        st->index_slots += ix->mask + 1;
+        if (atomic_load_explicit(&ix->prev, memory_order_relaxed)) st->index_growing++;
+        for (int q = 0; q < NQUEUES; ++q) st->queue_items[q] += s->lists[q].size;
+        if (cache->policy == CACHE_POLICY_TINYLFU || cache->policy == CACHE_POLICY_S3FIFO)
+            st->queue_target[0] += s->capacity * s->q0_pct / 100;
+        if (cache->policy == CACHE_POLICY_S3FIFO) st->ghost_items += ghost_count(&s->ghost);
+        /* every shard has the same class table */
+        st->nslab = s->slab.nclasses;
+        for (int c = 0; c < s->slab.nclasses && c < CACHE_SLAB_MAX_CLASSES; ++c) {
+            const slab_class_t *sc = &s->slab.classes[c];
+            st->slab[c].chunk_size = sc->chunk_size;
+            st->slab[c].pages += sc->npages;
+            st->slab[c].used_chunks += sc->used;
+            st->slab[c].free_chunks += sc->free_chunks;
+        }
+        st->slab_large_items += s->slab.large_count;
+        st->slab_large_bytes += s->slab.large_bytes;
+        pthread_mutex_unlock(&s->mu);
+    }
+}
+
+/* power-of-two bucket of a length, see CACHE_DEBUG_SIZE_BUCKETS */
+static int size_bucket(size_t len) {
+    int b = len ? 64 - __builtin_clzll((unsigned long long)len) : 0;
+    return b < CACHE_DEBUG_SIZE_BUCKETS ? b : CACHE_DEBUG_SIZE_BUCKETS - 1;
+}
+
+/* groups a lookup probes to reach slot i for hash, the same way index_find walks */
+static size_t probe_groups(const index_t *ix, unsigned long hash, size_t i) {
+    size_t pos = (size_t)hash & ix->mask & ~(size_t)(GROUP_WIDTH - 1);
+    size_t want = i & ~(size_t)(GROUP_WIDTH - 1), n = 1;
+    for (size_t step = GROUP_WIDTH; pos != want && step <= ix->mask; step += GROUP_WIDTH, ++n)
+        pos = (pos + step) & ix->mask;
+    return n;
+}
+
+int cache_debug(cache_debug_t *d) {
+    memset(d, 0, sizeof(*d));
+    if (!cache) return -1;
+    for (size_t i = 0; i < cache->nshards; ++i) {
+        shard_t *s = &cache->shards[i];
+        pthread_mutex_lock(&s->mu);
+        index_t *cur = atomic_load_explicit(&s->index, memory_order_relaxed);
+        if (atomic_load_explicit(&cur->prev, memory_order_relaxed)) d->index_growing++;
+        for (index_t *ix = cur; ix; ix = atomic_load_explicit(&ix->prev, memory_order_relaxed)) {
+            size_t nslots = ix->mask + 1;
+            d->index_slots += nslots;
+            d->index_used += ix->used;
+            d->index_tombstones += ix->tombstones;
+            d->index_bytes += sizeof(*ix) + nslots * (1 + sizeof(ix->slots[0]));
+            for (size_t j = 0; j < nslots; ++j) {
+                if (ix->ctrl[j] & 0x80) continue;
+                const entry_t *e = atomic_load_explicit(&ix->slots[j], memory_order_relaxed);
+                size_t g = probe_groups(ix, e->hash, j);
+                d->probe[g < CACHE_DEBUG_PROBE_BUCKETS ? g - 1 : CACHE_DEBUG_PROBE_BUCKETS - 1]++;
+                if (g > d->probe_max) d->probe_max = g;
+                size_t charge = entry_charge(s, e), need = ENTRY_HEADER + e->klen + e->vlen + 1;
+                if (entry_flags(e) & E_NEGATIVE) d->neg_entries++;
+                else d->entries++;
+                cache_size_bucket_t *kb = &d->key_sizes[size_bucket(e->klen)];
+                cache_size_bucket_t *vb = &d->value_sizes[size_bucket(e->vlen)];
+                kb->entries++;
+                kb->bytes += charge;
+                vb->entries++;
+                vb->bytes += charge;
+                d->payload_bytes += e->klen + e->vlen;
+                d->header_bytes += ENTRY_HEADER + 1;
+                d->slack_bytes += charge - need;
+            }
+        }
+        for (const entry_t *e = s->retired_head; e; e = ent(s, e->rnext)) d->retired++;
+        for (int c = 0; c < s->slab.nclasses; ++c) {
+            const slab_class_t *sc = &s->slab.classes[c];
+            d->slab_page_bytes += sc->npages * SLAB_PAGE_SIZE;
+            d->slab_free_bytes += sc->free_chunks * sc->chunk_size +
+                                  sc->npages * (SLAB_PAGE_SIZE - sc->per_page * sc->chunk_size);
+        }
+        d->large_bytes += s->slab.large_bytes;
+        d->evictions += s->evicted;
+        d->expired += s->expired;
+        pthread_mutex_unlock(&s->mu);
+    }
+    pthread_mutex_lock(&cache->ticker_mu);
+    d->nhistory = cache->hist_len;
+    for (int k = 0; k < cache->hist_len; ++k) {
+        int pos = (cache->hist_pos - cache->hist_len + k + CACHE_DEBUG_HISTORY) % CACHE_DEBUG_HISTORY;
+        d->evict_history[k] = cache->evict_hist[pos];
+        d->expire_history[k] = cache->expire_hist[pos];
+    }
+    pthread_mutex_unlock(&cache->ticker_mu);
+    return 0;
+}
+
+int cache_resize(size_t capacity, size_t bytes) {
+    if (!cache) return -1;
+    pthread_mutex_lock(&cache->resize_mu);
+    for (size_t i = 0; i < cache->nshards; ++i) {
+        shard_t *s = &cache->shards[i];
+        /* limits only change here, under resize_mu, so they can be read unlocked */
+        size_t cap = capacity == CACHE_KEEP ? s->capacity : shard_share(capacity, cache->nshards, i);
+        size_t bcap = bytes == CACHE_KEEP ? s->bytes_cap : shard_share(bytes, cache->nshards, i);
+        size_t est = est_entries(cap, bcap);
+        /* frequency tables follow the new size and start over; on failure the old ones stay */
+        sketch_t sk = {0};
+        ghost_t gh = {0};
+        if (est != est_entries(s->capacity, s->bytes_cap)) {
+            if (cache->policy == CACHE_POLICY_TINYLFU) sketch_init(&sk, est);
+            if (cache->policy == CACHE_POLICY_S3FIFO) ghost_init(&gh, ghost_cap(est, s->q0_pct));
+        }
+        pthread_mutex_lock(&s->mu);
+        if (sk.table) { sketch_t t = s->sketch; s->sketch = sk; sk = t; }
+        if (gh.fp) { ghost_t t = s->ghost; s->ghost = gh; gh = t; }
+        pthread_mutex_unlock(&s->mu);
+        free(sk.table);
+        free(gh.fp);
+        free(gh.seq);
+        /* lower the limits at most a batch below the current contents per
+           lock hold, so neither this loop nor a concurrent put evicts more */
+        for (int done = 0; !done;) {
+            pthread_mutex_lock(&s->mu);
+            maintain(s);
+            size_t used = shard_bytes(s);
+            size_t step = RESIZE_BATCH * (s->size ? used / s->size : EST_ENTRY_BYTES);
+            s->capacity = cap && s->size > cap + RESIZE_BATCH ? s->size - RESIZE_BATCH : cap;
+            __atomic_store_n(&s->bytes_cap, bcap && used > bcap + step ? used - step : bcap, __ATOMIC_RELAXED);
+            evict_if_needed(s);
+            done = s->capacity == cap && s->bytes_cap == bcap;
+            /* after a big shrink, move into a smaller index the same way it grows */
+            index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed);
+            size_t want = default_nslots(est > s->size ? est : s->size);
+            if (done && !atomic_load_explicit(&ix->prev, memory_order_relaxed) && ix->mask + 1 > 4 * want)
+                index_start_move(s, want);
+            pthread_mutex_unlock(&s->mu);
+        }
+        /* and finish that move here, a batch per lock hold: the big old
+           table would take writes far longer to empty than the small new
+           one takes to fill */
+        for (int moving = 1; moving;) {
+            pthread_mutex_lock(&s->mu);
+            index_migrate(s, RESIZE_BATCH * GROUP_WIDTH);
+            index_t *ix = atomic_load_explicit(&s->index, memory_order_relaxed);
+            moving = atomic_load_explicit(&ix->prev, memory_order_relaxed) != NULL;
+            pthread_mutex_unlock(&s->mu);
+        }
+    }
+    pthread_mutex_unlock(&cache->resize_mu);
+    return 0;
+}
+
+int cache_parse_size(const char *str, size_t *out) {
+    char *end = NULL;
+    /* strtoull would take "-1" as 2^64 - 1 */
+    if (!str || *str < '0' || *str > '9') return -1;
+    errno = 0;
+    unsigned long long n = strtoull(str, &end, 10);
+    if (errno == ERANGE || n > SIZE_MAX) return -1;
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    default: break;
+    }
+    if (*end || n > SIZE_MAX >> shift) return -1;
+    *out = (size_t)n << shift;
+    return 0;
+}
+
+static uint64_t wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* append one entry, decoded if compressed, laid out in *buf (grown as
+   needed; the caller frees it); the checksum covers exactly the bytes written */
+static int snap_write(FILE *f, const entry_t *e, uint64_t now, uint64_t *sum, char **buf, size_t *cap) {
+    uint32_t ulen = entry_ulen(e);
+    size_t vlen = ulen ? ulen : e->vlen;
+    size_t len = (size_t)e->klen + 1 + vlen + 1;
+    if (len > *cap) {
+        char *nb = realloc(*buf, len);
+        if (!nb) return -1;
+        *buf = nb;
+        *cap = len;
+    }
+    char *p = *buf;
+    memcpy(p, entry_key(e), e->klen);
+    p[e->klen] = '\0';
+    if (!ulen) memcpy(p + e->klen + 1, entry_value(e), vlen);
+    else if (lz_decompress(entry_value(e) + sizeof(ulen), e->vlen - sizeof(ulen), p + e->klen + 1, vlen) != 0)
+        return -1;
+    p[len - 1] = '\0';
+    snap_rec_t r = { e->klen, (uint32_t)vlen, e->expires_at ? e->expires_at - now : 0 };
+    *sum = hash_bytes_seed(&r, sizeof(r), *sum);
+    *sum = hash_bytes_seed(p, len, *sum);
+    return fwrite(&r, sizeof(r), 1, f) == 1 && fwrite(p, len, 1, f) == 1 ? 0 : -1;
+}
+
+int cache_snapshot_save(const char *path) {
+    if (!cache || !path) return -1;
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    snap_header_t h = { .version = SNAP_VERSION, .saved_at = wall_ms(), .checksum = SNAP_SEED };
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    int rc = fwrite(&h, sizeof(h), 1, f) == 1 ? 0 : -1;
+    char *buf = NULL;
+    size_t cap = 0;
+    for (size_t i = 0; i < cache->nshards && rc == 0; ++i) {
+        shard_t *s = &cache->shards[i];
+        pthread_mutex_lock(&s->mu);
+        uint64_t now = now_ms();
+        /* main before the window/small queue, each from its cold end: the
+           last entry loaded is the most recently used one. CLOCK and S3FIFO
+           don't reorder on a hit, so entries hit since insertion (freq set)
+           go after the rest. */
+        static const int order[] = { Q_MAIN, Q_WINDOW };
+        for (int q = 0; q < 2 && rc == 0; ++q) {
+            for (int hit = 0; hit < 2 && rc == 0; ++hit) {
+                for (const entry_t *e = s->lists[order[q]].tail; e && rc == 0; e = ent(s, e->prev)) {
+                    if (!atomic_load_explicit(&e->freq, memory_order_relaxed) != !hit) continue;
+                    if (e->expires_at && now >= e->expires_at) continue;
+                    rc = snap_write(f, e, now, &h.checksum, &buf, &cap);
+                    h.count++;
+                }
+            }
+        }
+        pthread_mutex_unlock(&s->mu);
+    }
+    free(buf);
+    /* header last, so a file cut short never verifies */
+    if (rc == 0 && (fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1)) rc = -1;
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) rc = -1;
+    if (fclose(f) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return (int)(h.count > 0x7fffffff ? 0x7fffffff : h.count);
+}
+
+/* walk the records of a mapped snapshot; with load set, put them in the cache.
+   Returns the number of records, or -1 if the file is malformed. */
+static long snap_walk(const char *p, const char *end, const snap_header_t *h, int load) {
+    uint64_t sum = SNAP_SEED;
+    uint64_t elapsed = 0, saved = h->saved_at, now = wall_ms();
+    if (now > saved) elapsed = now - saved;
+    long n = 0;
+    for (uint64_t i = 0; i < h->count; ++i) {
+        snap_rec_t r;
+        if ((size_t)(end - p) < sizeof(r)) return -1;
+        memcpy(&r, p, sizeof(r));
+        size_t len = (size_t)r.klen + 1 + r.vlen + 1;
+        const char *key = p + sizeof(r);
+        if ((size_t)(end - key) < len || key[r.klen] || key[r.klen + 1 + r.vlen]) return -1;
+        if (!load) {
+            sum = hash_bytes_seed(p, sizeof(r), sum);
+            sum = hash_bytes_seed(key, len, sum);
+        } else if (!r.ttl_ms || r.ttl_ms > elapsed) {
+            cache_key_t k = { key, r.klen, 0 };
+            k.hash = (unsigned long)hash_bytes(key, r.klen);
+            if (put_entry(&k, key + r.klen + 1, r.vlen, r.ttl_ms ? r.ttl_ms - elapsed : 0, 0) == 0) n++;
+        }
+        p = key + len;
+    }
+    if (!load && (p != end || sum != h->checksum)) return -1;
+    return load ? n : (long)h->count;
+}
+
+int cache_snapshot_load(const char *path) {
+    if (!cache || !path) return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(snap_header_t)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)sb.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+    snap_header_t h;
+    memcpy(&h, map, sizeof(h));
+    long n = -1;
+    /* verify everything first: a damaged file loads nothing */
+    if (memcmp(h.magic, SNAP_MAGIC, sizeof(h.magic)) == 0 && h.version == SNAP_VERSION &&
+        snap_walk(map + sizeof(h), map + size, &h, 0) >= 0)
+        n = snap_walk(map + sizeof(h), map + size, &h, 1);
+    munmap((void *)map, size);
+    if (n < 0) {
+        fprintf(stderr, "cache snapshot %s: bad or damaged file, ignored\n", path);
+        return -1;
+    }
+    /* loaded once: after a crash the next start must not bring back values
+       older than what the store has since seen */
+    unlink(path);
+    return (int)(n > 0x7fffffff ? 0x7fffffff : n);
 }
 
+/* must only run once no other thread can touch the cache */
 void cache_free(void) {
     if (!cache) return;
-    pthread_mutex_lock(&cache->mu);
-    for (size_t i = 0; i < cache->nbuckets; ++i) {
-        entry_t *cur = cache->buckets[i];
-        while (cur) {
-            entry_t *n = cur->hnext;
-            free(cur->key);
-            free(cur->value);
-            free(cur);
-            cur = n;
-        }
-    }
-    free(cache->buckets);
-    pthread_mutex_unlock(&cache->mu);
-    pthread_mutex_destroy(&cache->mu);
+    if (cache->ticker_stop == 0) {
+        pthread_mutex_lock(&cache->ticker_mu);
+        cache->ticker_stop = 1;
+        pthread_cond_signal(&cache->ticker_cv);
+        pthread_mutex_unlock(&cache->ticker_mu);
+        pthread_join(cache->ticker, NULL);
+    }
+    pthread_cond_destroy(&cache->ticker_cv);
+    pthread_mutex_destroy(&cache->ticker_mu);
+    if (cache->refresh_stop == 0) {
+        pthread_mutex_lock(&cache->refresh_mu);
+        cache->refresh_stop = 1;
+        pthread_cond_signal(&cache->refresh_cv);
+        pthread_mutex_unlock(&cache->refresh_mu);
+        pthread_join(cache->refresher, NULL);
+    }
+    for (; cache->refresh_len; cache->refresh_len--) {
+        free((char *)cache->refresh_q[cache->refresh_head].str);
+        cache->refresh_head = (cache->refresh_head + 1) % REFRESH_QUEUE;
+    }
+    pthread_cond_destroy(&cache->refresh_cv);
+    pthread_mutex_destroy(&cache->refresh_mu);
+    for (size_t i = 0; i < cache->nshards; ++i) {
+        shard_t *s = &cache->shards[i];
+        pthread_mutex_lock(&s->mu);
+        index_t *ix = atomic_load(&s->index);
+        for (index_t *t = ix; t; t = atomic_load(&t->prev)) {
+            for (size_t j = 0; j <= t->mask; ++j)
+                if (!(t->ctrl[j] & 0x80)) free_entry(s, atomic_load(&t->slots[j]));
+        }
+        if (atomic_load(&ix->prev)) index_free(atomic_load(&ix->prev));
+        index_free(ix);
+        while (s->retired_index) {
+            index_t *n = s->retired_index->rnext;
+            index_free(s->retired_index);
+            s->retired_index = n;
+        }
+        while (s->retired_head) {
+            entry_t *n = ent(s, s->retired_head->rnext);
+            free_entry(s, s->retired_head);
+            s->retired_head = n;
+        }
+        /* values must all be released before this point */
+        for (slab_h o = atomic_load(&s->orphans); o;) {
+            entry_t *e = ent(s, o);
+            o = e->rnext;
+            free_entry(s, e);
+        }
+        slab_destroy(&s->slab);
+        free(s->sketch.table);
+        free(s->ghost.fp);
+        free(s->ghost.seq);
+        pthread_mutex_unlock(&s->mu);
+        pthread_mutex_destroy(&s->mu);
+    }
+    /* every value must have been released, so no copy is pinned */
+    for (l1_t *l = cache->l1_list, *n; l; l = n) {
+        n = l->next;
+        for (size_t i = 0; i < cache->l1_slots; ++i) free(l->slots[i].val);
+        free(l);
+    }
+    pthread_mutex_destroy(&cache->l1_mu);
+    free(cache->shards);
+    pthread_mutex_destroy(&cache->resize_mu);
     free(cache);
     cache = NULL;
 }
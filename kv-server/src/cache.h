@@ -3,19 +3,204 @@
 
 #include <stddef.h>
 
-int cache_init(size_t capacity);
+typedef enum {
+    CACHE_POLICY_LRU = 0,  /* exact LRU, hits reorder a list */
+    CACHE_POLICY_CLOCK,    /* second chance: hits only set a reference bit */
+    CACHE_POLICY_TINYLFU,  /* W-TinyLFU: window LRU + frequency-gated main LRU */
+    CACHE_POLICY_S3FIFO,   /* small/main/ghost FIFOs, hits bump a small counter */
+} cache_policy_t;
+
+struct cache_key;
+
+/* reload key from the backing store and put the result back with
+   cache_put_refreshed; 0 if that was done, -1 to keep serving the old
+   value and retry on a later read */
+typedef int (*cache_refresh_fn)(const struct cache_key *key);
+
+typedef struct {
+    size_t capacity;  /* max entries across all shards, 0 = no entry limit */
+    size_t bytes;     /* max bytes charged for key, value and entry overhead, 0 = no limit */
+    size_t nshards;   /* number of independently locked shards */
+    cache_policy_t policy;
+    size_t small_pct; /* S3FIFO small queue share in percent (0 = default 10) */
+    unsigned long neg_ttl_ms; /* how long a negative entry lasts, 0 = none kept */
+    size_t neg_bytes; /* max bytes charged for negative entries across all shards */
+    unsigned long refresh_ms; /* reload an entry read this long after its put, 0 = off */
+    unsigned long stale_ms;   /* drop it if unread this long after that, 0 = never */
+    cache_refresh_fn refresh; /* runs on a cache thread; required for refresh_ms */
+    const char *snapshot_path; /* load (then remove) this snapshot at init, NULL = none */
+    int numa;         /* place each shard's memory on a NUMA node, moving it to its readers */
+    size_t l1_slots;  /* per-thread near-cache slots (rounded up to a power of two), 0 = off */
+    size_t compress_min; /* compress values of at least this many bytes, 0 = off */
+} cache_config_t;
+
+#define CACHE_SLAB_MAX_CLASSES 48
+
+/* memory held by one slab size class, summed over shards */
+typedef struct {
+    unsigned long chunk_size;
+    unsigned long pages;       /* pages of slab_page_size bytes */
+    unsigned long used_chunks;
+    unsigned long free_chunks;
+} cache_slab_class_t;
+
+typedef struct {
+    cache_policy_t policy;
+    unsigned long hits, misses, items;
+    unsigned long expired; /* entries removed by their TTL */
+    unsigned long neg_hits; /* reads answered by a negative entry (not in hits or misses) */
+    unsigned long neg_items, neg_bytes;
+    unsigned long stale_hits; /* hits served while the entry was due for refresh */
+    unsigned long l1_hits;    /* hits answered by a thread's near-cache (also in hits) */
+    unsigned long refreshes, refresh_dropped; /* reloads queued, and skipped with the queue full */
+    int numa_nodes;  /* 0 unless cfg.numa */
+    unsigned long numa_local, numa_remote; /* lookups from a thread on / off the shard's node */
+    unsigned long numa_moves; /* shards migrated to the node reading them most */
+    unsigned long z_items;    /* entries stored compressed */
+    unsigned long z_raw_bytes, z_bytes; /* their values' size before and after compression */
+    unsigned long z_compressed, z_skipped; /* puts stored compressed / tried but kept as is */
+    unsigned long z_encode_ns; /* time spent compressing */
+    unsigned long z_decoded, z_decode_ns; /* hits decoded, time spent (estimated from a sample) */
+    unsigned long capacity; /* entry limit, 0 = none */
+    unsigned long bytes_used, bytes_limit;
+    unsigned long index_slots;   /* hash index slots over all shards */
+    unsigned long index_growing; /* shards still moving entries into a bigger index */
+    /* per-queue occupancy: TINYLFU window/main, S3FIFO small/main */
+    unsigned long queue_items[2];
+    unsigned long queue_target[2]; /* entry target of the first queue (entry limit only) */
+    unsigned long ghost_items;     /* S3FIFO ghost fingerprints still live */
+    int nslab;
+    cache_slab_class_t slab[CACHE_SLAB_MAX_CLASSES];
+    unsigned long slab_page_size;
+    unsigned long slab_large_items, slab_large_bytes; /* entries too big for a slab chunk */
+} cache_stats_t;
+
+int cache_init(const cache_config_t *cfg);
 void cache_free(void);
 
-/* Return newly allocated value (caller frees) or NULL if not found */
-char *cache_get(const char *key);
+/* map "lru"/"clock"/"tinylfu"/"s3fifo" to a policy; returns 0 on success, -1 if unknown */
+int cache_policy_parse(const char *name, cache_policy_t *out);
+const char *cache_policy_name(void);
+
+/* A key and its hash. Build it once per request with cache_key_init
+   (after cache_init, which seeds the hash) and pass it to every call;
+   str is borrowed, not copied. */
+typedef struct cache_key {
+    const char *str;
+    size_t len;
+    unsigned long hash;
+} cache_key_t;
+
+void cache_key_init(cache_key_t *k, const char *str);
+
+/* A reference to an immutable cached value. data stays valid, even if the
+   key is updated or evicted meanwhile, until cache_value_release, which
+   must run on the thread that called cache_get (cfg.l1_slots values are
+   that thread's private copies). */
+typedef struct {
+    const char *data; /* len bytes, which may include NULs; a NUL follows them */
+    size_t len;
+    void *ref;
+} cache_value_t;
+
+/* 0 and a reference in *out on a hit, CACHE_NEGATIVE if the key is cached
+   as absent (no reference taken), -1 if not found */
+#define CACHE_NEGATIVE 1
+int cache_get(const cache_key_t *key, cache_value_t *out);
+void cache_value_release(cache_value_t *v);
 
-/* Put or update — makes internal copies of key/value */
-int cache_put(const char *key, const char *value);
+/* hint that key is hot: with cfg.l1_slots, the calling thread's near-cache
+   copies it on its next hit instead of waiting for a second one */
+void cache_l1_prefer(const cache_key_t *key);
+
+/* Put or update — makes internal copies of key and the len value bytes */
+int cache_put(const cache_key_t *key, const char *value, size_t len);
+/* same, but the entry expires ttl_ms from now (0 = never); reads never see it after that */
+int cache_put_ttl(const cache_key_t *key, const char *value, size_t len, unsigned long ttl_ms);
 
 /* Remove key from cache */
-int cache_delete(const char *key);
+int cache_delete(const cache_key_t *key);
+
+/* Put a reloaded value for a key handed to cfg.refresh, or value NULL if
+   the store no longer has the key. Only replaces the entry if it is still
+   waiting for this refresh, so a newer put wins; 0 if applied. */
+int cache_put_refreshed(const cache_key_t *key, const char *value, size_t len, unsigned long ttl_ms);
+
+/* Remember that the store has no such key, for cfg.neg_ttl_ms. Never
+   replaces a cached value; a later put replaces it. 0 if the key is now
+   cached as absent, -1 otherwise. */
+int cache_put_negative(const cache_key_t *key);
+
+/* After key was deleted from the store: drop its entry and leave a
+   negative one in its place, under one shard lock. seq is
+   cache_write_seq(key) taken before the store delete; if any value was
+   put to the key's shard since, that put may be newer than the delete,
+   so no negative entry is left. 0 if one was. */
+unsigned long cache_write_seq(const cache_key_t *key);
+int cache_delete_negative(const cache_key_t *key, unsigned long seq);
+
+/* Change the entry and byte limits while the cache is in use (0 = no
+   limit, CACHE_KEEP = leave as is). Shrinking evicts in small batches;
+   returns once every shard is within its new limits. */
+#define CACHE_KEEP ((size_t)-1)
+int cache_resize(size_t capacity, size_t bytes);
+
+/* parse a size with an optional K/M/G suffix; 0 on success, -1 if malformed */
+int cache_parse_size(const char *str, size_t *out);
+
+/* Write every live entry to path (via path.tmp and a rename), in an
+   order that loading restores recency from. Returns the number of
+   entries written, -1 on error. Meant for shutdown: writers to the shard
+   being saved wait meanwhile. */
+int cache_snapshot_save(const char *path);
+/* Map a snapshot and put its entries, remaining TTLs aged by the time
+   since the save; nothing is loaded unless the whole file checks out.
+   The file is removed once loaded. Returns entries loaded, -1 on error. */
+int cache_snapshot_load(const char *path);
+
+/* stats (summed over all shards) */
+void cache_stats(cache_stats_t *st);
+
+#define CACHE_DEBUG_SIZE_BUCKETS 32 /* bucket 0: length 0; i: [2^(i-1), 2^i); the last also takes longer */
+#define CACHE_DEBUG_PROBE_BUCKETS 16 /* bucket i: found in group i + 1 of its probe sequence; the last also takes later */
+#define CACHE_DEBUG_HISTORY 60      /* eviction counts kept, one per interval */
+#define CACHE_DEBUG_INTERVAL_S 10
+
+typedef struct {
+    unsigned long entries, bytes; /* bytes: what the entries are charged */
+} cache_size_bucket_t;
+
+/* where the cache's memory goes, from a walk over every entry */
+typedef struct {
+    unsigned long entries, neg_entries;
+    unsigned long retired; /* unlinked, freed once no reader can hold them */
+    cache_size_bucket_t key_sizes[CACHE_DEBUG_SIZE_BUCKETS];
+    cache_size_bucket_t value_sizes[CACHE_DEBUG_SIZE_BUCKETS]; /* as stored, i.e. compressed */
+    /* memory: entries take payload + header + slack; slab pages also hold
+       free chunks and page tails */
+    unsigned long payload_bytes; /* keys and values */
+    unsigned long header_bytes;  /* per-entry header and terminator */
+    unsigned long slack_bytes;   /* chunk bytes past what their entries need */
+    unsigned long slab_page_bytes, slab_free_bytes; /* free: unused chunks and page tails */
+    unsigned long large_bytes;   /* entries too big for a slab chunk */
+    unsigned long index_bytes;   /* control bytes and slots, both tables while growing */
+    /* hash index */
+    unsigned long index_slots, index_used, index_tombstones;
+    unsigned long index_growing;
+    unsigned long probe[CACHE_DEBUG_PROBE_BUCKETS];
+    unsigned long probe_max; /* groups */
+    /* entries evicted for room (not expired or deleted) and expired, in
+       total and per CACHE_DEBUG_INTERVAL_S over the last nhistory intervals,
+       oldest first */
+    unsigned long evictions, expired;
+    int nhistory;
+    unsigned long evict_history[CACHE_DEBUG_HISTORY];
+    unsigned long expire_history[CACHE_DEBUG_HISTORY];
+} cache_debug_t;
 
-/* stats */
-void cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *items);
+/* Fill d by walking every shard's entries, one shard at a time under its
+   lock, so writers to that shard wait meanwhile; for debugging, not for
+   polling. 0 on success, -1 without a cache. */
+int cache_debug(cache_debug_t *d);
 
 #endif
@@ -6,6 +6,9 @@
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <endian.h>
 
 typedef struct {
     PGconn *conn;
@@ -16,6 +19,31 @@ static dbconn_t *pool = NULL;
 static int pool_size = 0;
 static unsigned int rr_idx = 0; /* round-robin index */
 
+/* expired rows are deleted this many at a time, so the sweeper never holds
+   a pool connection (or row locks) for long */
+#define SWEEP_BATCH 1000
+
+static pthread_t sweeper;
+static int sweeper_running = 0;
+static int sweeper_stop = 0;
+static int sweep_interval_s = 0;
+static pthread_mutex_t sweeper_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sweeper_cv = PTHREAD_COND_INITIALIZER;
+
+/* columns added after the first release; harmless if already there */
+static const char *schema_upgrade =
+    "ALTER TABLE kv_store ADD COLUMN IF NOT EXISTS expires_at TIMESTAMPTZ;"
+    "CREATE INDEX IF NOT EXISTS kv_store_expires_at_idx ON kv_store (expires_at) WHERE expires_at IS NOT NULL;";
+
+/* upsert used by db_put and db_write_batch: $1 key, $2 value (binary), $3 ttl ms */
+static const char *put_sql =
+    "INSERT INTO kv_store(key, value, expires_at) VALUES($1, $2, "
+    "CASE WHEN $3::bigint > 0 THEN now() + $3::bigint * interval '1 millisecond' END) "
+    "ON CONFLICT (key) DO UPDATE SET value = EXCLUDED.value, expires_at = EXCLUDED.expires_at";
+
+/* rows fetched per FETCH during warm-up */
+#define WARMUP_BATCH 2000
+
 int db_init(const char *conninfo, int pool_s) {
     if (pool) return 0;
     pool = calloc(pool_s, sizeof(dbconn_t));
@@ -38,10 +66,22 @@ int db_init(const char *conninfo, int pool_s) {
         pthread_mutex_init(&pool[i].mu, NULL);
         fprintf(stderr, "db_init: connection %d OK\n", i);
     }
+    PGresult *res = PQexec(pool[0].conn, schema_upgrade);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+        fprintf(stderr, "db_init: schema upgrade failed: %s\n", PQerrorMessage(pool[0].conn));
+    PQclear(res);
     return 0;
 }
 
 void db_shutdown(void) {
+    if (sweeper_running) {
+        pthread_mutex_lock(&sweeper_mu);
+        __atomic_store_n(&sweeper_stop, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&sweeper_cv);
+        pthread_mutex_unlock(&sweeper_mu);
+        pthread_join(sweeper, NULL);
+        sweeper_running = 0;
+    }
     if (!pool) return;
     for (int i = 0; i < pool_size; ++i) {
         PQfinish(pool[i].conn);
@@ -64,8 +104,18 @@ static void release_conn(dbconn_t *c) {
     pthread_mutex_unlock(&c->mu);
 }
 
-/* db_get: returns 0 on success and sets *value_out (malloc'd) and *value_len, -1 on not found/error */
-int db_get(const char *key, char **value_out, int *value_len) {
+/* a bigint column of a binary-format result: 8 bytes big-endian; 0 if
+   it is NULL or not that size */
+static long binary_int8(const PGresult *res, int row, int col) {
+    uint64_t v;
+    if (PQgetlength(res, row, col) != (int)sizeof(v)) return 0;
+    memcpy(&v, PQgetvalue(res, row, col), sizeof(v));
+    return (long)be64toh(v);
+}
+
+/* db_get: returns 0 on success and sets *value_out (malloc'd), *value_len and
+   *ttl_ms (time left in ms, 0 = no expiry), 1 if not found/expired, -1 on error */
+int db_get(const char *key, char **value_out, int *value_len, long *ttl_ms) {
     if (!pool) {
         fprintf(stderr, "db_get: pool not initialized\n");
         return -1;
@@ -78,13 +128,15 @@ int db_get(const char *key, char **value_out, int *value_len) {
 
     const char *paramValues[1] = { key };
     PGresult *res = PQexecParams(c->conn,
-                                "SELECT value FROM kv_store WHERE key = $1",
+                                "SELECT value, CASE WHEN expires_at IS NULL THEN 0 ELSE "
+                                "GREATEST(1, CEIL(EXTRACT(EPOCH FROM expires_at - now()) * 1000))::bigint END "
+                                "FROM kv_store WHERE key = $1 AND (expires_at IS NULL OR expires_at > now())",
                                 1,       /* nParams */
                                 NULL,    /* paramTypes (text) */
                                 paramValues,
                                 NULL,    /* paramLengths */
                                 NULL,    /* paramFormats (text) */
-                                0);      /* resultFormat: text */
+                                1);      /* resultFormat: binary, so bytea is not hex-escaped */
 
     if (PQresultStatus(res) != PGRES_TUPLES_OK) {
         /* Not necessarily fatal; print error for debugging */
@@ -98,13 +150,13 @@ int db_get(const char *key, char **value_out, int *value_len) {
         PQclear(res);
         release_conn(c);
         fprintf(stderr, "db_get: key='%s' not found\n", key);
-        return -1; /* not found */
+        return 1; /* not found */
     }
 
     /* Get first row, first column */
     int len = PQgetlength(res, 0, 0);
     const char *data = PQgetvalue(res, 0, 0);
-    /* allocate and copy (ensure null-terminated) */
+    /* allocate and copy (null-terminated for convenience; len is what counts) */
     *value_out = malloc(len + 1);
     if (!*value_out) {
         PQclear(res);
@@ -115,6 +167,7 @@ int db_get(const char *key, char **value_out, int *value_len) {
     memcpy(*value_out, data, len);
     (*value_out)[len] = '\0';
     if (value_len) *value_len = len;
+    if (ttl_ms) *ttl_ms = binary_int8(res, 0, 1);
 
     PQclear(res);
     release_conn(c);
@@ -122,8 +175,10 @@ int db_get(const char *key, char **value_out, int *value_len) {
     return 0;
 }
 
-/* db_put: insert or update value. value_len is number of bytes. Returns 0 on success. */
-int db_put(const char *key, const char *value, int value_len) {
+/* db_put: insert or update value. value_len is number of bytes, sent as a
+   binary parameter so any bytes go in unescaped; the row expires ttl_ms
+   from now (0 = never). Returns 0 on success. */
+int db_put(const char *key, const char *value, int value_len, long ttl_ms) {
     if (!pool) {
         fprintf(stderr, "db_put: pool not initialized\n");
         return -1;
@@ -134,15 +189,19 @@ int db_put(const char *key, const char *value, int value_len) {
         return -1;
     }
 
-    const char *paramValues[2] = { key, value };
+    char ttl_str[24];
+    snprintf(ttl_str, sizeof(ttl_str), "%ld", ttl_ms > 0 ? ttl_ms : 0);
+    const char *paramValues[3] = { key, value, ttl_str };
+    const int paramLengths[3] = { 0, value_len, 0 };
+    const int paramFormats[3] = { 0, 1, 0 }; /* value binary, the rest text */
 
     PGresult *res = PQexecParams(c->conn,
-                                 "INSERT INTO kv_store(key, value) VALUES($1, $2) ON CONFLICT (key) DO UPDATE SET value = EXCLUDED.value",
-                                 2,
+                                 put_sql,
+                                 3,
                                  NULL,  /* paramTypes */
                                  paramValues,
-                                 NULL,  /* paramLengths */
-                                 NULL,  /* paramFormats (text) */
+                                 paramLengths,
+                                 paramFormats,
                                  0);    /* resultFormat (text) */
 
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
@@ -190,3 +249,250 @@ int db_delete(const char *key) {
     fprintf(stderr, "db_delete: OK key='%s'\n", key);
     return 0;
 }
+
+/* db_write_batch: BEGIN, each write, COMMIT on one connection, so the
+   batch pays for a single commit */
+int db_write_batch(const db_write_t *w, int n) {
+    if (!pool) return -1;
+    dbconn_t *c = acquire_conn();
+    if (!c) return -1;
+    PGresult *res = PQexec(c->conn, "BEGIN");
+    int ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    for (int i = 0; i < n && ok; ++i) {
+        char ttl_str[24];
+        snprintf(ttl_str, sizeof(ttl_str), "%ld", w[i].ttl_ms > 0 ? w[i].ttl_ms : 0);
+        const char *paramValues[3] = { w[i].key, w[i].value, ttl_str };
+        const int paramLengths[3] = { 0, w[i].len, 0 };
+        const int paramFormats[3] = { 0, 1, 0 };
+        if (w[i].del)
+            res = PQexecParams(c->conn, "DELETE FROM kv_store WHERE key = $1", 1, NULL, paramValues, NULL, NULL, 0);
+        else
+            res = PQexecParams(c->conn, put_sql, 3, NULL, paramValues, paramLengths, paramFormats, 0);
+        ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+        if (!ok) fprintf(stderr, "db_write_batch: write %d (key='%s') failed: %s\n", i, w[i].key, PQerrorMessage(c->conn));
+        PQclear(res);
+    }
+    res = PQexec(c->conn, ok ? "COMMIT" : "ROLLBACK");
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) ok = 0;
+    PQclear(res);
+    release_conn(c);
+    return ok ? 0 : -1;
+}
+
+/* delete up to SWEEP_BATCH expired rows; returns how many went, -1 on error */
+static int sweep_batch(void) {
+    dbconn_t *c = acquire_conn();
+    if (!c) return -1;
+    char batch[16];
+    snprintf(batch, sizeof(batch), "%d", SWEEP_BATCH);
+    const char *paramValues[1] = { batch };
+    PGresult *res = PQexecParams(c->conn,
+                                 /* rechecked on the row itself: a key rewritten since the
+                                    subquery saw it must survive */
+                                 "DELETE FROM kv_store WHERE key IN (SELECT key FROM kv_store "
+                                 "WHERE expires_at <= now() LIMIT $1::int) AND expires_at <= now()",
+                                 1, NULL, paramValues, NULL, NULL, 0);
+    int n = -1;
+    if (PQresultStatus(res) == PGRES_COMMAND_OK) n = atoi(PQcmdTuples(res));
+    else fprintf(stderr, "db sweeper: delete failed: %s\n", PQerrorMessage(c->conn));
+    PQclear(res);
+    release_conn(c);
+    return n;
+}
+
+static void *sweeper_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&sweeper_mu);
+    while (!sweeper_stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += sweep_interval_s;
+        pthread_cond_timedwait(&sweeper_cv, &sweeper_mu, &ts);
+        if (sweeper_stop) break;
+        pthread_mutex_unlock(&sweeper_mu);
+        /* batches until the backlog is gone; the pool connection is
+           released between batches so requests can interleave */
+        long total = 0;
+        int n;
+        while ((n = sweep_batch()) > 0) {
+            total += n;
+            if (n < SWEEP_BATCH || __atomic_load_n(&sweeper_stop, __ATOMIC_RELAXED)) break;
+        }
+        if (total) fprintf(stderr, "db sweeper: removed %ld expired rows\n", total);
+        pthread_mutex_lock(&sweeper_mu);
+    }
+    pthread_mutex_unlock(&sweeper_mu);
+    return NULL;
+}
+
+int db_sweeper_start(int interval_s) {
+    if (!pool || sweeper_running || interval_s <= 0) return -1;
+    sweep_interval_s = interval_s;
+    sweeper_stop = 0;
+    if (pthread_create(&sweeper, NULL, sweeper_main, NULL) != 0) return -1;
+    sweeper_running = 1;
+    return 0;
+}
+
+typedef struct {
+    dbconn_t *c;
+    int part, nparts;
+    const char *cutoff, *cutoff_key; /* first (created_at, key) to load, NULL = every dated row */
+    long *undated_left; /* shared budget for rows without created_at */
+    db_warmup_fn fn;
+    void *arg;
+    long rows;
+    int failed;
+    int threaded; /* ran on its own thread, to be joined */
+    pthread_t tid;
+} warmup_part_t;
+
+static int exec_ok(PGconn *conn, const char *sql) {
+    PGresult *res = PQexec(conn, sql);
+    int ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) fprintf(stderr, "db warmup: %s: %s\n", sql, PQerrorMessage(conn));
+    PQclear(res);
+    return ok;
+}
+
+#define WARMUP_SELECT                                                                         \
+    "DECLARE warm BINARY NO SCROLL CURSOR FOR "                                               \
+    "SELECT key, value, CASE WHEN expires_at IS NULL THEN 0 ELSE "                            \
+    "GREATEST(1, CEIL(EXTRACT(EPOCH FROM expires_at - now()) * 1000))::bigint END "           \
+    "FROM kv_store WHERE (hashtext(key) & 2147483647) % $1::int = $2::int "                   \
+    "AND (expires_at IS NULL OR expires_at > now()) "
+
+/* run one cursor to the end, or until the budget (if any) runs out */
+static int warmup_cursor(warmup_part_t *w, const char *sql, int nparams,
+                         const char *const *paramValues, long *budget) {
+    PGconn *conn = w->c->conn;
+    /* binary: values come back as raw bytes, as in db_get */
+    PGresult *res = PQexecParams(conn, sql, nparams, NULL, paramValues, NULL, NULL, 0);
+    int ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) fprintf(stderr, "db warmup: declare failed: %s\n", PQerrorMessage(conn));
+    PQclear(res);
+    char fetch[48];
+    snprintf(fetch, sizeof(fetch), "FETCH %d FROM warm", WARMUP_BATCH);
+    int more = ok;
+    while (more) {
+        res = PQexec(conn, fetch);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            fprintf(stderr, "db warmup: fetch failed: %s\n", PQerrorMessage(conn));
+            PQclear(res);
+            ok = 0;
+            break;
+        }
+        int n = PQntuples(res);
+        more = n == WARMUP_BATCH;
+        for (int i = 0; i < n; ++i) {
+            if (budget && __atomic_fetch_sub(budget, 1, __ATOMIC_RELAXED) <= 0) {
+                more = 0;
+                break;
+            }
+            if (w->fn(PQgetvalue(res, i, 0), PQgetvalue(res, i, 1), PQgetlength(res, i, 1),
+                      binary_int8(res, i, 2), w->arg) == 0)
+                w->rows++;
+        }
+        PQclear(res);
+    }
+    if (ok) ok = exec_ok(conn, "CLOSE warm");
+    return ok;
+}
+
+/* stream one hash partition of the selected rows through server-side
+   cursors on this worker's own pool connection, oldest first so the most
+   recently written keys end up hottest in the cache: rows without an
+   created_at count as oldest and only fill what the dated rows leave of n */
+static void *warmup_main(void *arg) {
+    warmup_part_t *w = arg;
+    PGconn *conn = w->c->conn;
+    char part[16], nparts[16];
+    snprintf(part, sizeof(part), "%d", w->part);
+    snprintf(nparts, sizeof(nparts), "%d", w->nparts);
+    const char *paramValues[4] = { nparts, part, w->cutoff, w->cutoff_key };
+    pthread_mutex_lock(&w->c->mu);
+    if (!exec_ok(conn, "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY")) {
+        w->failed = 1;
+        pthread_mutex_unlock(&w->c->mu);
+        return NULL;
+    }
+    int ok = 1;
+    if (__atomic_load_n(w->undated_left, __ATOMIC_RELAXED) > 0)
+        ok = warmup_cursor(w, WARMUP_SELECT "AND created_at IS NULL", 2, paramValues,
+                           w->undated_left);
+    if (ok)
+        ok = warmup_cursor(w, WARMUP_SELECT "AND created_at IS NOT NULL "
+                              "AND ($3::timestamp IS NULL OR (created_at, key) >= ($3::timestamp, $4::text)) "
+                              "ORDER BY created_at, key",
+                           4, paramValues, NULL);
+    exec_ok(conn, "COMMIT"); /* also ends a failed transaction */
+    w->failed = !ok;
+    pthread_mutex_unlock(&w->c->mu);
+    return NULL;
+}
+
+long db_warmup(long n, db_warmup_fn fn, void *arg) {
+    if (!pool || n <= 0) return -1;
+    /* the n-th newest row by (created_at, key): partitions then select
+       from it on, so ties on created_at don't let in more than n. Rows
+       without one never set it, or a NULL there would lift the bound */
+    char cutoff[64] = "";
+    char *cutoff_key = NULL;
+    long undated_left = 0;
+    char limit[24];
+    snprintf(limit, sizeof(limit), "%ld", n - 1);
+    const char *paramValues[1] = { limit };
+    dbconn_t *c = acquire_conn();
+    if (!c) return -1;
+    PGresult *res = PQexecParams(c->conn,
+                                 "SELECT created_at, key FROM kv_store "
+                                 "WHERE (expires_at IS NULL OR expires_at > now()) "
+                                 "AND created_at IS NOT NULL "
+                                 "ORDER BY created_at DESC, key DESC OFFSET $1::bigint LIMIT 1",
+                                 1, NULL, paramValues, NULL, NULL, 0);
+    int ok = PQresultStatus(res) == PGRES_TUPLES_OK;
+    if (!ok) fprintf(stderr, "db warmup: cutoff query failed: %s\n", PQerrorMessage(c->conn));
+    else if (PQntuples(res) == 1) {
+        snprintf(cutoff, sizeof(cutoff), "%s", PQgetvalue(res, 0, 0));
+        if (!(cutoff_key = strdup(PQgetvalue(res, 0, 1)))) ok = 0;
+    }
+    PQclear(res);
+    if (ok && !cutoff_key) {
+        /* fewer than n dated rows: take them all, and undated ones up to n */
+        res = PQexec(c->conn, "SELECT count(*) FROM kv_store "
+                              "WHERE (expires_at IS NULL OR expires_at > now()) "
+                              "AND created_at IS NOT NULL");
+        ok = PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1;
+        if (!ok) fprintf(stderr, "db warmup: count query failed: %s\n", PQerrorMessage(c->conn));
+        else undated_left = n - atol(PQgetvalue(res, 0, 0));
+        PQclear(res);
+    }
+    release_conn(c);
+    if (!ok) return -1;
+
+    /* one partition per pool connection, each on its own thread */
+    warmup_part_t *parts = calloc(pool_size, sizeof(*parts));
+    if (!parts) {
+        free(cutoff_key);
+        return -1;
+    }
+    for (int i = 0; i < pool_size; ++i) {
+        warmup_part_t *w = &parts[i];
+        *w = (warmup_part_t){ .c = &pool[i], .part = i, .nparts = pool_size,
+                              .cutoff = cutoff_key ? cutoff : NULL, .cutoff_key = cutoff_key,
+                              .undated_left = &undated_left, .fn = fn, .arg = arg };
+        w->threaded = pthread_create(&w->tid, NULL, warmup_main, w) == 0;
+        if (!w->threaded) warmup_main(w); /* no thread: do this part here */
+    }
+    long rows = 0;
+    int failed = 0;
+    for (int i = 0; i < pool_size; ++i) {
+        if (parts[i].threaded) pthread_join(parts[i].tid, NULL);
+        rows += parts[i].rows;
+        failed |= parts[i].failed;
+    }
+    free(parts);
+    free(cutoff_key);
+    return failed && !rows ? -1 : rows;
+}
@@ -5,13 +5,40 @@
 int db_init(const char *conninfo, int pool_size);
 void db_shutdown(void);
 
-/* DB operations:
-   - db_get returns newly allocated value (caller frees). returns 0 on success, -1 not found or error.
-   - db_put inserts or updates value; returns 0 on success, -1 otherwise.
+/* DB operations (values are byte strings: pointer plus length, may contain NULs):
+   - db_get returns newly allocated value (caller frees; NUL follows the
+     *value_len bytes) and the time it has left (ttl_ms, 0 = no
+     expiry; may be NULL). returns 0 on success, 1 if not found or expired, -1 on error.
+   - db_put inserts or updates value, expiring ttl_ms from now (0 = never); returns 0 on success, -1 otherwise.
    - db_delete deletes key; returns 0 on success, -1 if not found/error.
 */
-int db_get(const char *key, char **value_out, int *value_len);
-int db_put(const char *key, const char *value, int value_len);
+int db_get(const char *key, char **value_out, int *value_len, long *ttl_ms);
+int db_put(const char *key, const char *value, int value_len, long ttl_ms);
 int db_delete(const char *key);
 
+/* one write of a batch: a put (ttl_ms as for db_put), or a delete */
+typedef struct {
+    const char *key;
+    const char *value;
+    int len;
+    long ttl_ms;
+    int del;
+} db_write_t;
+
+/* apply n writes in order in a single transaction; 0 if all committed */
+int db_write_batch(const db_write_t *w, int n);
+
+/* Start a background thread that deletes expired rows every interval_s
+   seconds, in batches. Stopped by db_shutdown. Returns 0 on success. */
+int db_sweeper_start(int interval_s);
+
+/* called for each warm-up row (value is len bytes); 0 if it was used */
+typedef int (*db_warmup_fn)(const char *key, const char *value, int len, long ttl_ms, void *arg);
+
+/* Stream the n most recently created live rows (by created_at, then key;
+   rows with none count as oldest) into fn, oldest first, split by key
+   hash over every pool connection in parallel; fn runs on those threads.
+   Returns rows used, -1 on error. */
+long db_warmup(long n, db_warmup_fn fn, void *arg);
+
 #endif /* DB_H */
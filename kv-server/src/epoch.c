@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+#include "epoch.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ Each thread owns one record holding (epoch << 1) | active. Records are
+ pushed onto a global list once and never freed; when a thread exits its
+ record is marked unused and can be adopted by the next new thread.
+*/
+
+typedef struct epoch_rec {
+    _Atomic uint64_t state;
+    atomic_int in_use;
+    struct epoch_rec *next;
+} __attribute__((aligned(64))) epoch_rec_t;
+
+/* starts at 2 so that stamp + 2 never needs underflow checks */
+static _Atomic uint64_t global_epoch = 2;
+static _Atomic(epoch_rec_t *) records = NULL;
+
+static __thread epoch_rec_t *self = NULL;
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static void release_rec(void *p) {
+    epoch_rec_t *r = p;
+    atomic_store(&r->state, 0);
+    atomic_store(&r->in_use, 0);
+}
+
+static void make_exit_key(void) {
+    pthread_key_create(&exit_key, release_rec);
+}
+
+static epoch_rec_t *register_thread(void) {
+    pthread_once(&exit_key_once, make_exit_key);
+    epoch_rec_t *r;
+    for (r = atomic_load(&records); r; r = r->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&r->in_use, &expected, 1)) break;
+    }
+    if (!r) {
+        r = aligned_alloc(64, sizeof(epoch_rec_t));
+        if (!r) abort();
+        atomic_init(&r->state, 0);
+        atomic_init(&r->in_use, 1);
+        r->next = atomic_load(&records);
+        while (!atomic_compare_exchange_weak(&records, &r->next, r))
+            ;
+    }
+    pthread_setspecific(exit_key, r);
+    self = r;
+    return r;
+}
+
+void epoch_enter(void) {
+    epoch_rec_t *r = self ? self : register_thread();
+    uint64_t g = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+    /* seq_cst store: later loads of shared pointers must not move above it */
+    atomic_store(&r->state, (g << 1) | 1);
+}
+
+void epoch_exit(void) {
+    atomic_store_explicit(&self->state, 0, memory_order_release);
+}
+
+uint64_t epoch_now(void) {
+    return atomic_load(&global_epoch);
+}
+
+uint64_t epoch_try_advance(void) {
+    uint64_t g = atomic_load(&global_epoch);
+    for (epoch_rec_t *r = atomic_load(&records); r; r = r->next) {
+        uint64_t st = atomic_load(&r->state);
+        if ((st & 1) && (st >> 1) != g) return g; /* a reader still lags */
+    }
+    if (atomic_compare_exchange_strong(&global_epoch, &g, g + 1)) return g + 1;
+    return g; /* someone else advanced it; g holds the new value */
+}
+
+int epoch_reclaimable(uint64_t stamp, uint64_t now) {
+    return now >= stamp + 2;
+}
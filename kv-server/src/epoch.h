@@ -0,0 +1,28 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+
+/*
+ Epoch-based reclamation for lock-free readers.
+
+ Readers bracket every access to shared nodes with epoch_enter/epoch_exit.
+ Writers unlink a node, stamp it with epoch_now() and keep it on a retire
+ list; it may be freed once epoch_reclaimable(stamp) is true, i.e. after
+ every reader that could still hold a pointer to it has left.
+*/
+
+void epoch_enter(void);
+void epoch_exit(void);
+
+/* current global epoch, used to stamp retired nodes */
+uint64_t epoch_now(void);
+
+/* advance the global epoch if every active reader has caught up;
+   returns the (possibly new) global epoch. Never blocks. */
+uint64_t epoch_try_advance(void);
+
+/* true when a node retired at 'stamp' can no longer be seen by any reader */
+int epoch_reclaimable(uint64_t stamp, uint64_t now);
+
+#endif
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include "flight.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ Calls in flight hang off one of FLIGHT_STRIPES lists picked by hash,
+ each with its own mutex and condition variable, so unrelated misses
+ rarely share a lock. A call is heap allocated and freed by whichever of
+ the leader and its waiters leaves last; the value each caller gets is a
+ private copy.
+*/
+
+#define FLIGHT_STRIPES 64
+
+typedef struct call {
+    struct call *next;
+    const char *key; /* the leader's; only read while the call is listed */
+    unsigned long hash;
+    int done;
+    int waiters;
+    flight_result_t res;
+} call_t;
+
+typedef struct {
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    call_t *calls;
+} __attribute__((aligned(64))) stripe_t;
+
+static stripe_t stripes[FLIGHT_STRIPES] = {
+    [0 ... FLIGHT_STRIPES - 1] = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL },
+};
+static atomic_ulong coalesced = 0;
+
+static void copy_result(flight_result_t *out, const flight_result_t *res) {
+    *out = *res;
+    out->value = NULL;
+    if (res->value) {
+        out->value = malloc(res->len + 1);
+        if (!out->value) { out->rc = -1; return; }
+        memcpy(out->value, res->value, res->len + 1);
+    }
+}
+
+static void free_call(call_t *c) {
+    free(c->res.value);
+    free(c);
+}
+
+int flight_do(const char *key, unsigned long hash, flight_fetch_fn fetch, void *arg,
+              flight_result_t *out, int *shared) {
+    stripe_t *st = &stripes[(hash >> 7) % FLIGHT_STRIPES];
+    pthread_mutex_lock(&st->mu);
+    call_t *c;
+    for (c = st->calls; c; c = c->next)
+        if (c->hash == hash && strcmp(c->key, key) == 0) break;
+    if (c) {
+        c->waiters++;
+        atomic_fetch_add_explicit(&coalesced, 1, memory_order_relaxed);
+        while (!c->done) pthread_cond_wait(&st->cv, &st->mu);
+        copy_result(out, &c->res);
+        int last = --c->waiters == 0;
+        pthread_mutex_unlock(&st->mu);
+        if (last) free_call(c);
+        if (shared) *shared = 1;
+        return out->rc;
+    }
+    c = calloc(1, sizeof(*c));
+    if (!c) {
+        /* can't register: fetch alone */
+        pthread_mutex_unlock(&st->mu);
+        memset(out, 0, sizeof(*out));
+        out->rc = fetch(key, arg, out);
+        if (shared) *shared = 0;
+        return out->rc;
+    }
+    c->key = key;
+    c->hash = hash;
+    c->next = st->calls;
+    st->calls = c;
+    pthread_mutex_unlock(&st->mu);
+
+    c->res.rc = fetch(key, arg, &c->res);
+
+    pthread_mutex_lock(&st->mu);
+    for (call_t **pp = &st->calls; *pp; pp = &(*pp)->next)
+        if (*pp == c) { *pp = c->next; break; }
+    c->done = 1;
+    int alone = c->waiters == 0;
+    if (!alone) {
+        /* copied before unlocking: the last waiter out frees c */
+        copy_result(out, &c->res);
+        pthread_cond_broadcast(&st->cv);
+    }
+    pthread_mutex_unlock(&st->mu);
+    if (alone) {
+        /* nobody to share with: hand over the value itself */
+        *out = c->res;
+        free(c);
+    }
+    if (shared) *shared = 0;
+    return out->rc;
+}
+
+unsigned long flight_coalesced(void) {
+    return atomic_load_explicit(&coalesced, memory_order_relaxed);
+}
@@ -0,0 +1,34 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stddef.h>
+
+/*
+ Singleflight: coalesces concurrent loads of the same key. The first
+ caller for a key runs the fetch; callers arriving while it runs wait for
+ it and share its result instead of running their own.
+*/
+
+typedef struct {
+    int rc;        /* what the fetch returned */
+    char *value;   /* malloc'd, caller frees; NULL unless the fetch set one */
+    int len;
+    long ttl_ms;
+} flight_result_t;
+
+/* fills res (res->value malloc'd or NULL) and returns its rc. Runs in
+   the leading caller's thread before any waiter wakes, so anything it
+   caches is visible to requests that come after. */
+typedef int (*flight_fetch_fn)(const char *key, void *arg, flight_result_t *res);
+
+/* Run fetch for key, or wait for the run already in flight for it.
+   hash is any hash of key (e.g. cache_key_t.hash). Every caller gets
+   its own copy of the value in *out; *shared is set if the result came
+   from another caller's fetch. Returns out->rc. */
+int flight_do(const char *key, unsigned long hash, flight_fetch_fn fetch, void *arg,
+              flight_result_t *out, int *shared);
+
+/* callers that waited for someone else's fetch, since startup */
+unsigned long flight_coalesced(void);
+
+#endif
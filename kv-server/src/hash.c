@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include "hash.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+static const uint64_t P0 = 0x2d358dccaa6c78a5ULL, P1 = 0x8bb84b93962eacc9ULL,
+                      P2 = 0x4b33a62ed433d4a3ULL, P3 = 0x4d5a2da51de1aa47ULL;
+
+static uint64_t seed;
+static pthread_once_t seed_once = PTHREAD_ONCE_INIT;
+
+static inline void mum(uint64_t *a, uint64_t *b) {
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t r8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t r4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* 1..3 bytes: first, middle and last byte */
+static inline uint64_t r3(const unsigned char *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static void pick_seed(void) {
+    uint64_t s;
+    if (getrandom(&s, sizeof(s), GRND_NONBLOCK) != (ssize_t)sizeof(s)) {
+        /* no entropy yet (early boot): still better than a constant */
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        s = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+    }
+    seed = mix(s ^ P0, P1);
+}
+
+void hash_seed_init(void) {
+    pthread_once(&seed_once, pick_seed);
+}
+
+uint64_t hash_bytes(const void *key, size_t len) {
+    return hash_bytes_seed(key, len, seed);
+}
+
+uint64_t hash_bytes_seed(const void *key, size_t len, uint64_t s) {
+    const unsigned char *p = key;
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            /* two overlapping 4 byte reads from each end cover 4..16 bytes */
+            size_t off = (len >> 3) << 2;
+            a = (r4(p) << 32) | r4(p + off);
+            b = (r4(p + len - 4) << 32) | r4(p + len - 4 - off);
+        } else if (len > 0) {
+            a = r3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t s1 = s, s2 = s;
+            do {
+                s = mix(r8(p) ^ P1, r8(p + 8) ^ s);
+                s1 = mix(r8(p + 16) ^ P2, r8(p + 24) ^ s1);
+                s2 = mix(r8(p + 32) ^ P3, r8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            s ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            s = mix(r8(p) ^ P1, r8(p + 8) ^ s);
+            p += 16;
+            i -= 16;
+        }
+        /* last 16 bytes, overlapping what was already mixed */
+        a = r8(p + i - 16);
+        b = r8(p + i - 8);
+    }
+    a ^= P1;
+    b ^= s;
+    mum(&a, &b);
+    return mix(a ^ P0 ^ len, b ^ P1);
+}
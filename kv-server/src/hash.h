@@ -0,0 +1,24 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ Keyed 64-bit hash for cache keys, in the wyhash family: 8/16 byte reads
+ folded with 64x64->128 bit multiplies, so short keys cost a few
+ multiplies instead of a loop per byte. The seed is drawn at random by
+ hash_seed_init so that clients cannot precompute colliding keys; hashes
+ are therefore only meaningful within one process.
+*/
+
+/* pick the process-wide random seed; safe to call more than once */
+void hash_seed_init(void);
+
+uint64_t hash_bytes(const void *p, size_t len);
+
+/* same hash with a caller-chosen seed, stable across processes (for
+   checksums); not for anything a client can choose the input of */
+uint64_t hash_bytes_seed(const void *p, size_t len, uint64_t seed);
+
+#endif
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include "hotkeys.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ Each thread passes on one request in HK_SAMPLE, picked at random, and
+ drops the rest before touching anything shared: a key with a share of
+ the load keeps about that share of the sample, and hotkeys_top scales
+ the counts back up. Sampled requests update one of HK_STRIPES
+ independent summaries, each under its own mutex, so they rarely wait on
+ each other; hotkeys_top merges them (Space-Saving summaries add up key
+ by key). A stripe has
+ HK_OVERSAMPLE * k counters, found by key through a small open-addressing
+ table and ordered by count in a min-heap, so a request costs a probe and
+ a short sift whether or not its key is tracked.
+
+ Decay is by generation: every HOTKEYS_HALF_LIFE_S seconds the global
+ generation moves on, and a stripe halves its counts for each generation
+ it missed the next time it is touched (halving keeps the heap order).
+ With a steady rate r a count then runs between r*H and 2*r*H (H the
+ half-life), and is r*(H + t) at t seconds into a half-life, which is
+ what the rate is derived from.
+*/
+
+#define HK_STRIPES 16
+#define HK_MAX 256
+#define HK_OVERSAMPLE 8  /* counters per reported key */
+#define HK_INLINE 48     /* keys up to this long live in the counter */
+#define HK_HOT_MIN 16    /* a hot key has at least this many guaranteed requests */
+#define HK_SAMPLE 16     /* one request in this many is counted (a power of two) */
+#define HALF_LIFE_MS (HOTKEYS_HALF_LIFE_S * 1000UL)
+
+typedef struct {
+    char *key; /* inl or malloc'd */
+    size_t len;
+    unsigned long hash;
+    unsigned long count, error, hits, misses, writes;
+    int hpos; /* position in the heap */
+    char inl[HK_INLINE];
+} counter_t;
+
+typedef struct {
+    pthread_mutex_t mu;
+    counter_t *c;  /* ncap of them, the first n in use */
+    int *heap;     /* counter indices, min-heap by count */
+    int *tab;      /* counter index + 1 by hash, 0 = empty; tab_mask + 1 slots */
+    int n;
+    unsigned long total; /* decayed requests seen */
+    unsigned gen;        /* decay generation applied */
+} __attribute__((aligned(64))) stripe_t;
+
+static stripe_t stripes[HK_STRIPES] = {
+    [0 ... HK_STRIPES - 1] = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, NULL, 0, 0, 0 },
+};
+static int hk_k, ncap;
+static size_t tab_mask;
+static int hk_on;
+static atomic_ulong hk_start; /* ms at which the current generation began */
+static atomic_uint hk_gen;
+static atomic_uint next_stripe = 0;
+static __thread int my_stripe = -1;
+static __thread uint32_t my_rnd;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* the current generation, moving it on if a half-life has passed */
+static unsigned current_gen(uint64_t now) {
+    unsigned long start = atomic_load_explicit(&hk_start, memory_order_acquire);
+    while (now - start >= HALF_LIFE_MS) {
+        unsigned long steps = (now - start) / HALF_LIFE_MS;
+        if (atomic_compare_exchange_weak_explicit(&hk_start, &start, start + steps * HALF_LIFE_MS,
+                                                  memory_order_acq_rel, memory_order_acquire)) {
+            atomic_fetch_add_explicit(&hk_gen, (unsigned)steps, memory_order_release);
+            break;
+        }
+    }
+    return atomic_load_explicit(&hk_gen, memory_order_acquire);
+}
+
+/* caller holds st->mu */
+static void decay_to(stripe_t *st, unsigned gen) {
+    unsigned d = gen - st->gen;
+    if (!d) return;
+    unsigned sh = d > 63 ? 63 : d;
+    for (int i = 0; i < st->n; ++i) {
+        counter_t *c = &st->c[i];
+        c->count >>= sh;
+        c->error >>= sh;
+        c->hits >>= sh;
+        c->misses >>= sh;
+        c->writes >>= sh;
+    }
+    st->total >>= sh;
+    st->gen = gen;
+}
+
+/* ---------- lookup table ---------- */
+
+static int tab_find(const stripe_t *st, const char *key, size_t len, unsigned long hash) {
+    for (size_t i = hash & tab_mask;; i = (i + 1) & tab_mask) {
+        int ci = st->tab[i] - 1;
+        if (ci < 0) return -1;
+        const counter_t *c = &st->c[ci];
+        if (c->hash == hash && c->len == len && memcmp(c->key, key, len) == 0) return ci;
+    }
+}
+
+static void tab_insert(stripe_t *st, int ci) {
+    size_t i = st->c[ci].hash & tab_mask;
+    while (st->tab[i]) i = (i + 1) & tab_mask;
+    st->tab[i] = ci + 1;
+}
+
+/* backward-shift deletion keeps probe runs unbroken without tombstones */
+static void tab_remove(stripe_t *st, int ci) {
+    size_t i = st->c[ci].hash & tab_mask;
+    while (st->tab[i] != ci + 1) i = (i + 1) & tab_mask;
+    for (size_t j = (i + 1) & tab_mask; st->tab[j]; j = (j + 1) & tab_mask) {
+        size_t home = st->c[st->tab[j] - 1].hash & tab_mask;
+        /* move j back into the hole unless its home lies after the hole */
+        if (((j - home) & tab_mask) >= ((j - i) & tab_mask)) {
+            st->tab[i] = st->tab[j];
+            i = j;
+        }
+    }
+    st->tab[i] = 0;
+}
+
+/* ---------- heap ---------- */
+
+static void heap_swap(stripe_t *st, int a, int b) {
+    int t = st->heap[a];
+    st->heap[a] = st->heap[b];
+    st->heap[b] = t;
+    st->c[st->heap[a]].hpos = a;
+    st->c[st->heap[b]].hpos = b;
+}
+
+/* counts only grow between decays, so entries only ever move down */
+static void heap_down(stripe_t *st, int p) {
+    for (;;) {
+        int l = 2 * p + 1, m = p;
+        if (l < st->n && st->c[st->heap[l]].count < st->c[st->heap[m]].count) m = l;
+        if (l + 1 < st->n && st->c[st->heap[l + 1]].count < st->c[st->heap[m]].count) m = l + 1;
+        if (m == p) return;
+        heap_swap(st, p, m);
+        p = m;
+    }
+}
+
+static void counter_clear_key(counter_t *c) {
+    if (c->key && c->key != c->inl) free(c->key);
+    c->key = NULL;
+    c->len = 0;
+}
+
+static void stripe_free(stripe_t *st) {
+    for (int j = 0; j < st->n; ++j) counter_clear_key(&st->c[j]);
+    free(st->c);
+    free(st->heap);
+    free(st->tab);
+    st->c = NULL;
+    st->heap = st->tab = NULL;
+    st->n = 0;
+}
+
+int hotkeys_init(int k) {
+    if (hk_on || k <= 0) return k <= 0 ? 0 : -1;
+    if (k > HK_MAX) k = HK_MAX;
+    ncap = k * HK_OVERSAMPLE;
+    size_t tsize = 1;
+    while (tsize < (size_t)ncap * 2) tsize <<= 1;
+    tab_mask = tsize - 1;
+    for (int i = 0; i < HK_STRIPES; ++i) {
+        stripe_t *st = &stripes[i];
+        st->c = calloc((size_t)ncap, sizeof(counter_t));
+        st->heap = calloc((size_t)ncap, sizeof(int));
+        st->tab = calloc(tsize, sizeof(int));
+        st->n = 0;
+        st->total = 0;
+        st->gen = 0;
+        if (!st->c || !st->heap || !st->tab) {
+            for (int j = 0; j <= i; ++j) stripe_free(&stripes[j]);
+            return -1;
+        }
+    }
+    hk_k = k;
+    atomic_store(&hk_gen, 0);
+    atomic_store(&hk_start, now_ms());
+    __atomic_store_n(&hk_on, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* only once no request is being served */
+void hotkeys_free(void) {
+    if (!hk_on) return;
+    __atomic_store_n(&hk_on, 0, __ATOMIC_RELEASE);
+    for (int i = 0; i < HK_STRIPES; ++i) {
+        pthread_mutex_lock(&stripes[i].mu);
+        stripe_free(&stripes[i]);
+        pthread_mutex_unlock(&stripes[i].mu);
+    }
+}
+
+int hotkeys_enabled(void) {
+    return __atomic_load_n(&hk_on, __ATOMIC_ACQUIRE);
+}
+
+/* xorshift32; a counter stepping in lockstep with a client's request
+   pattern could miss its keys every time */
+static int sampled(void) {
+    uint32_t x = my_rnd;
+    if (!x) x = (uint32_t)(uintptr_t)&my_rnd | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    my_rnd = x;
+    return (x & (HK_SAMPLE - 1)) == 0;
+}
+
+int hotkeys_record(const char *key, size_t len, unsigned long hash, int kind) {
+    if (!hotkeys_enabled() || !sampled()) return 0;
+    if (my_stripe < 0) my_stripe = (int)(atomic_fetch_add(&next_stripe, 1) % HK_STRIPES);
+    stripe_t *st = &stripes[my_stripe];
+    unsigned gen = current_gen(now_ms());
+    pthread_mutex_lock(&st->mu);
+    decay_to(st, gen);
+    st->total++;
+    int ci = tab_find(st, key, len, hash);
+    counter_t *c;
+    char *copy = NULL;
+    if (ci >= 0) {
+        c = &st->c[ci];
+    } else if (len >= HK_INLINE && !(copy = malloc(len + 1))) {
+        pthread_mutex_unlock(&st->mu);
+        return 0; /* out of memory: the key goes uncounted */
+    } else {
+        if (st->n < ncap) {
+            ci = st->n;
+            c = &st->c[ci];
+            c->count = c->error = 0;
+            c->hpos = st->n;
+            st->heap[st->n++] = ci;
+        } else {
+            /* Space-Saving: the newcomer takes the smallest counter, whose
+               count becomes its possible overestimate */
+            ci = st->heap[0];
+            c = &st->c[ci];
+            tab_remove(st, ci);
+            c->error = c->count;
+        }
+        counter_clear_key(c);
+        c->key = copy ? copy : c->inl;
+        memcpy(c->key, key, len);
+        c->key[len] = '\0';
+        c->len = len;
+        c->hash = hash;
+        c->hits = c->misses = c->writes = 0;
+        tab_insert(st, ci);
+    }
+    c->count++;
+    if (kind == HOTKEY_HIT) c->hits++;
+    else if (kind == HOTKEY_MISS) c->misses++;
+    else c->writes++;
+    heap_down(st, c->hpos);
+    unsigned long sure = c->count - c->error;
+    int hot = sure * HK_SAMPLE >= HK_HOT_MIN && sure * 100 >= st->total * HOTKEYS_HOT_PCT;
+    pthread_mutex_unlock(&st->mu);
+    return hot;
+}
+
+static int cmp_key(const void *a, const void *b) {
+    const hotkey_t *x = a, *y = b;
+    if (x->len != y->len) return x->len < y->len ? -1 : 1;
+    return memcmp(x->key, y->key, x->len);
+}
+
+static int cmp_count(const void *a, const void *b) {
+    const hotkey_t *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+void hotkeys_release(hotkey_t *keys, int n) {
+    if (!keys) return;
+    for (int i = 0; i < n; ++i) free(keys[i].key);
+    free(keys);
+}
+
+int hotkeys_top(hotkey_t **out) {
+    *out = NULL;
+    if (!hotkeys_enabled()) return 0;
+    hotkey_t *all = calloc((size_t)HK_STRIPES * ncap, sizeof(*all));
+    if (!all) return -1;
+    uint64_t now = now_ms();
+    unsigned gen = current_gen(now);
+    unsigned long start = atomic_load_explicit(&hk_start, memory_order_acquire);
+    unsigned long total = 0;
+    int n = 0;
+    for (int i = 0; i < HK_STRIPES; ++i) {
+        stripe_t *st = &stripes[i];
+        pthread_mutex_lock(&st->mu);
+        decay_to(st, gen);
+        total += st->total;
+        for (int j = 0; j < st->n; ++j) {
+            const counter_t *c = &st->c[j];
+            if (!c->count) continue;
+            hotkey_t *h = &all[n];
+            if (!(h->key = malloc(c->len + 1))) continue;
+            memcpy(h->key, c->key, c->len + 1);
+            h->len = c->len;
+            h->count = c->count;
+            h->error = c->error;
+            h->hits = c->hits;
+            h->misses = c->misses;
+            h->writes = c->writes;
+            n++;
+        }
+        pthread_mutex_unlock(&st->mu);
+    }
+    /* the same key tracked by several stripes: add its counters up */
+    qsort(all, n, sizeof(*all), cmp_key);
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        if (m && cmp_key(&all[m - 1], &all[i]) == 0) {
+            hotkey_t *d = &all[m - 1];
+            d->count += all[i].count;
+            d->error += all[i].error;
+            d->hits += all[i].hits;
+            d->misses += all[i].misses;
+            d->writes += all[i].writes;
+            free(all[i].key);
+        } else {
+            all[m++] = all[i];
+        }
+    }
+    qsort(all, m, sizeof(*all), cmp_count);
+    for (int i = hk_k; i < m; ++i) free(all[i].key);
+    if (m > hk_k) m = hk_k;
+    double elapsed = (HALF_LIFE_MS + (now > start ? now - start : 0)) / 1000.0;
+    for (int i = 0; i < m; ++i) {
+        hotkey_t *h = &all[i];
+        unsigned long sure = h->count - h->error;
+        h->hot = sure * HK_SAMPLE >= HK_HOT_MIN && sure * 100 >= total * HOTKEYS_HOT_PCT;
+        /* in requests rather than samples */
+        h->count *= HK_SAMPLE;
+        h->error *= HK_SAMPLE;
+        h->hits *= HK_SAMPLE;
+        h->misses *= HK_SAMPLE;
+        h->writes *= HK_SAMPLE;
+        h->rate = h->count / elapsed;
+    }
+    *out = all;
+    return m;
+}
@@ -0,0 +1,47 @@
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+#include <stddef.h>
+
+/*
+ Streaming heavy-hitter tracker (Space-Saving): keeps a fixed number of
+ counters, and a key that is not tracked takes over the smallest one,
+ inheriting its count as the key's possible overestimate. Any key seen
+ more than total/counters times is always tracked; there are several
+ times more counters than keys reported, so the top k are reliable.
+ Counts halve every HOTKEYS_HALF_LIFE_S seconds so the list follows the
+ current load.
+*/
+
+#define HOTKEYS_HALF_LIFE_S 30
+#define HOTKEYS_HOT_PCT 1 /* a key with at least this share of requests is hot */
+
+enum { HOTKEY_HIT, HOTKEY_MISS, HOTKEY_WRITE };
+
+/* track the k heaviest keys (k <= 256); 0 on success */
+int hotkeys_init(int k);
+void hotkeys_free(void);
+int hotkeys_enabled(void);
+
+/* count one request for key (hash: any hash of it, e.g. cache_key_t.hash);
+   returns 1 if the key is hot. Only a random sample of calls gets past a
+   thread-local check, so most cost no lock, clock read or allocation,
+   and only those can return 1. */
+int hotkeys_record(const char *key, size_t len, unsigned long hash, int kind);
+
+typedef struct {
+    char *key;
+    size_t len;
+    double rate;          /* requests per second, recent */
+    unsigned long count;  /* decayed request count, possibly over by up to error */
+    unsigned long error;
+    unsigned long hits, misses, writes; /* decayed, counted since it was last tracked */
+    int hot;
+} hotkey_t;
+
+/* the heaviest keys, heaviest first, in a malloc'd array for
+   hotkeys_release; returns how many, -1 on error */
+int hotkeys_top(hotkey_t **out);
+void hotkeys_release(hotkey_t *keys, int n);
+
+#endif
@@ -2,6 +2,10 @@
 #include "http.h"
 #include "cache.h"
 #include "db.h"
+#include "flight.h"
+#include "wal.h"
+#include "numa.h"
+#include "hotkeys.h"
 #include <civetweb.h>
 #include <stdlib.h>
 #include <string.h>
@@ -54,7 +58,148 @@ static int parse_form_kv(const char *body, char **key_out, char **value_out) {
     return 0;
 }
 
-/* POST /kv  - accept form or small JSON {"key":"k","value":"v"} */
+/* optional ttl in seconds (fractions allowed): a "ttl" JSON field, or a
+   ttl= form/query variable in vars. Sets *ttl_ms (0 = never expires);
+   returns -1 if present but not a non-negative number. */
+static int parse_ttl(const char *json, const char *vars, long *ttl_ms) {
+    char buf[32];
+    const char *num = NULL;
+    const char *tpos = json ? strstr(json, "\"ttl\"") : NULL;
+    if (tpos) {
+        const char *colon = strchr(tpos, ':');
+        if (!colon) return -1;
+        num = colon + 1;
+        while (*num == ' ' || *num == '\t' || *num == '\"') num++;
+    } else if (vars && mg_get_var(vars, strlen(vars), "ttl", buf, sizeof(buf)) >= 0) {
+        num = buf;
+    }
+    *ttl_ms = 0;
+    if (!num) return 0;
+    char *end;
+    double secs = strtod(num, &end);
+    if (end == num || secs < 0 || secs > 1e9) return -1;
+    *ttl_ms = (long)(secs * 1000 + 0.5);
+    if (secs > 0 && *ttl_ms == 0) *ttl_ms = 1;
+    return 0;
+}
+
+/* Writes go to the write-back log when it is enabled, else straight to
+   the database; reads then check the log first, since the database may
+   not have its latest writes yet. */
+static int store_get(const char *key, char **value, int *len, long *ttl_ms) {
+    if (wal_enabled()) {
+        int rc = wal_get(key, value, len, ttl_ms);
+        if (rc == -2) return -1; /* a failure: the database row may be older */
+        if (rc >= 0) return rc;
+    }
+    return db_get(key, value, len, ttl_ms);
+}
+
+static int store_put(const char *key, const char *value, int len, long ttl_ms) {
+    return wal_enabled() ? wal_put(key, value, len, ttl_ms) : db_put(key, value, len, ttl_ms);
+}
+
+/* 0 if deleted, nonzero if there was no such key or the delete failed */
+static int store_delete(const char *key) {
+    if (!wal_enabled()) return db_delete(key);
+    /* the log takes a delete of any key: look the key up first, so a
+       missing one still gets a 404 as db_delete gives it */
+    char *val = NULL;
+    int len = 0;
+    long ttl_ms = 0;
+    int rc = store_get(key, &val, &len, &ttl_ms);
+    free(val);
+    return rc == 0 ? wal_delete(key) : -1;
+}
+
+/* singleflight fetch for a GET miss: read the row and fill the cache
+   before any coalesced waiter is woken */
+static int fetch_from_db(const char *key, void *arg, flight_result_t *res) {
+    const cache_key_t *ck = arg;
+    int rc = store_get(key, &res->value, &res->len, &res->ttl_ms);
+    if (rc == 0) {
+        /* cached for no longer than the row has left */
+        cache_put_ttl(ck, res->value, (size_t)res->len, (unsigned long)res->ttl_ms);
+    } else if (rc > 0) {
+        /* only a real "no such row" is remembered, never a failed query */
+        cache_put_negative(ck);
+    }
+    return rc;
+}
+
+/* refresh-ahead reload, on the cache's refresher thread: the old value
+   keeps being served until this puts the new one */
+static int refresh_from_db(const cache_key_t *ck) {
+    char *val = NULL;
+    int len = 0;
+    long ttl_ms = 0;
+    int rc = store_get(ck->str, &val, &len, &ttl_ms);
+    if (rc < 0) return -1;
+    cache_put_refreshed(ck, rc == 0 ? val : NULL, (size_t)len, (unsigned long)ttl_ms);
+    free(val);
+    return 0;
+}
+
+/* one warm-up row; runs on a db_warmup thread */
+static int warm_put(const char *key, const char *value, int len, long ttl_ms, void *arg) {
+    (void)arg;
+    cache_key_t ck;
+    cache_key_init(&ck, key);
+    return cache_put_ttl(&ck, value, (size_t)len, (unsigned long)ttl_ms);
+}
+
+/* read the whole request body (mg_read may return it in pieces); returns
+   bytes read, -1 on error. buf has room for len + 1, and is NUL terminated */
+static int read_body(struct mg_connection *conn, char *buf, int len) {
+    int got = 0;
+    while (got < len) {
+        int n = mg_read(conn, buf + got, len - got);
+        if (n <= 0) break;
+        got += n;
+    }
+    buf[got] = '\0';
+    return got > 0 ? got : -1;
+}
+
+/* write len bytes as the inside of a JSON string; quotes, backslashes and
+   control bytes are escaped, everything else goes out in runs */
+static void write_json_string(struct mg_connection *conn, const char *p, size_t len) {
+    size_t run = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)p[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        if (i > run) mg_write(conn, p + run, i - run);
+        char esc[8];
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\';
+            esc[1] = (char)c;
+            mg_write(conn, esc, 2);
+        } else {
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            mg_write(conn, esc, 6);
+        }
+        run = i + 1;
+    }
+    if (len > run) mg_write(conn, p + run, len - run);
+}
+
+/* 200 with a value: the bytes themselves for Accept: application/octet-stream,
+   the JSON envelope otherwise (label says where it came from) */
+static void send_value(struct mg_connection *conn, const char *key, const char *label, const char *data, size_t len) {
+    const char *accept = mg_get_header(conn, "Accept");
+    if (accept && strstr(accept, "application/octet-stream")) {
+        mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %zu\r\n\r\n", len);
+        mg_write(conn, data, len);
+        return;
+    }
+    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"key\":\"");
+    write_json_string(conn, key, strlen(key));
+    mg_printf(conn, "\",\"%s\":\"", label);
+    write_json_string(conn, data, len);
+    mg_printf(conn, "\"}\n");
+}
+
+/* POST /kv  - accept form or small JSON {"key":"k","value":"v","ttl":60} */
 static int handle_post_kv(struct mg_connection *conn, void *cbdata) {
     (void)cbdata;
     const struct mg_request_info *ri = mg_get_request_info(conn);
@@ -75,7 +220,7 @@ static int handle_post_kv(struct mg_connection *conn, void *cbdata) {
         mg_printf(conn, "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\n\r\nMemory error\n");
         return 1;
     }
-    int read = mg_read(conn, body, content_len);
+    int read = read_body(conn, body, content_len);
     if (read <= 0) {
         free(body);
         mg_printf(conn, "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\n\r\nFailed read body\n");
@@ -84,6 +229,7 @@ static int handle_post_kv(struct mg_connection *conn, void *cbdata) {
     body[read] = '\0';
 
     char *key = NULL, *value = NULL;
+    size_t vlen = 0;
 
     const char *ct = mg_get_header(conn, "Content-Type");
     if (!ct) ct = "";
@@ -94,6 +240,7 @@ static int handle_post_kv(struct mg_connection *conn, void *cbdata) {
             mg_printf(conn, "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\n\r\nInvalid form\n");
             return 1;
         }
+        vlen = strlen(value);
     } else {
         /* naive JSON parse */
         char *kpos = strstr(body, "\"key\"");
@@ -123,7 +270,8 @@ static int handle_post_kv(struct mg_connection *conn, void *cbdata) {
                     if (end) {
                         size_t len = end - start;
                         value = malloc(len + 1);
-                        strncpy(value, start, len); value[len] = '\0';
+                        memcpy(value, start, len); value[len] = '\0';
+                        vlen = len;
                     }
                 }
             }
@@ -138,8 +286,18 @@ static int handle_post_kv(struct mg_connection *conn, void *cbdata) {
         return 1;
     }
 
-    /* persist to DB first */
-    if (db_put(key, value, (int)strlen(value)) != 0) {
+    long ttl_ms = 0;
+    int is_form = strstr(ct, "application/x-www-form-urlencoded") != NULL;
+    if (parse_ttl(is_form ? NULL : body, is_form ? body : ri->query_string, &ttl_ms) != 0) {
+        free(body);
+        free(key);
+        free(value);
+        mg_printf(conn, "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\n\r\nInvalid ttl\n");
+        return 1;
+    }
+
+    /* persist first (to the DB, or the write-back log) */
+    if (store_put(key, value, (int)vlen, ttl_ms) != 0) {
         fprintf(stderr, "handle_post_kv: db_put failed for key='%s'\n", key);
         free(body);
         free(key);
@@ -149,7 +307,10 @@ static int handle_post_kv(struct mg_connection *conn, void *cbdata) {
     }
     fprintf(stderr, "handle_post_kv: db_put OK for key='%s'\n", key);
 
-    cache_put(key, value);
+    cache_key_t ck;
+    cache_key_init(&ck, key);
+    cache_put_ttl(&ck, value, vlen, (unsigned long)ttl_ms);
+    hotkeys_record(key, strlen(key), ck.hash, HOTKEY_WRITE);
 
     mg_printf(conn, "HTTP/1.1 201 Created\r\nContent-Type: application/json\r\n\r\n{\"status\":\"ok\"}\n");
 
@@ -159,6 +320,67 @@ static int handle_post_kv(struct mg_connection *conn, void *cbdata) {
     return 1;
 }
 
+/* PUT /kv/<key>[?ttl=seconds]  - the body is the value, byte for byte
+   (e.g. Content-Type: application/octet-stream) */
+static int handle_put_kv(struct mg_connection *conn, void *cbdata) {
+    (void)cbdata;
+    const struct mg_request_info *ri = mg_get_request_info(conn);
+    const char *uri = ri->local_uri ? ri->local_uri : ri->request_uri;
+    const char *kstart = strncmp(uri, "/kv/", 4) == 0 ? uri + 4 : "";
+    size_t klen = strcspn(kstart, "?");
+    if (klen == 0) {
+        mg_printf(conn, "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\n\r\nMissing key in URI\n");
+        return 1;
+    }
+    long long content_len = ri->content_length;
+    if (content_len < 0 || content_len > 10 * 1024 * 1024) {
+        mg_printf(conn, "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\n\r\nBad content length\n");
+        return 1;
+    }
+    long ttl_ms = 0;
+    if (parse_ttl(NULL, ri->query_string, &ttl_ms) != 0) {
+        mg_printf(conn, "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\n\r\nInvalid ttl\n");
+        return 1;
+    }
+    char *raw = strndup(kstart, klen);
+    char *key = malloc(klen + 1);
+    char *body = malloc((size_t)content_len + 1);
+    if (!raw || !key || !body) {
+        free(raw);
+        free(key);
+        free(body);
+        mg_printf(conn, "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\n\r\nMemory error\n");
+        return 1;
+    }
+    url_decode(key, raw);
+    free(raw);
+    int len = content_len ? read_body(conn, body, (int)content_len) : 0;
+    if (len != (int)content_len) {
+        free(key);
+        free(body);
+        mg_printf(conn, "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\n\r\nFailed read body\n");
+        return 1;
+    }
+    body[len] = '\0';
+
+    if (store_put(key, body, len, ttl_ms) != 0) {
+        fprintf(stderr, "handle_put_kv: db_put failed for key='%s'\n", key);
+        free(key);
+        free(body);
+        mg_printf(conn, "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\n\r\nDB error\n");
+        return 1;
+    }
+    cache_key_t ck;
+    cache_key_init(&ck, key);
+    cache_put_ttl(&ck, body, (size_t)len, (unsigned long)ttl_ms);
+    hotkeys_record(key, strlen(key), ck.hash, HOTKEY_WRITE);
+
+    mg_printf(conn, "HTTP/1.1 201 Created\r\nContent-Type: application/json\r\n\r\n{\"status\":\"ok\"}\n");
+    free(key);
+    free(body);
+    return 1;
+}
+
 static int handle_get_kv(struct mg_connection *conn, void *cbdata) {
     (void)cbdata;
     const struct mg_request_info *ri = mg_get_request_info(conn);
@@ -213,28 +435,45 @@ static int handle_get_kv(struct mg_connection *conn, void *cbdata) {
 
     fprintf(stderr, "handle_get_kv: looking up key='%s'\n", key);
 
-    char *val = cache_get(key);
-    if (val) {
+    /* hashed once, reused for the fill on a miss */
+    cache_key_t ck;
+    cache_key_init(&ck, key);
+    cache_value_t val;
+    int rc = cache_get(&ck, &val);
+    /* a hot key skips the near-cache's second-hit admission */
+    /* a negative entry answers for a key the store doesn't have: a miss */
+    if (hotkeys_record(key, strlen(key), ck.hash, rc == 0 ? HOTKEY_HIT : HOTKEY_MISS))
+        cache_l1_prefer(&ck);
+    if (rc == 0) {
         fprintf(stderr, "handle_get_kv: cache HIT for key='%s'\n", key);
-        mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"key\":\"%s\",\"value(Cache)\":\"%s\"}\n", key, val);
-        free(val);
+        /* the value goes to the socket straight from the cache entry */
+        send_value(conn, key, "value(Cache)", val.data, val.len);
+        cache_value_release(&val);
+        free(key);
+        return 1;
+    } else if (rc == CACHE_NEGATIVE) {
+        /* the store said no a moment ago; don't ask again */
+        fprintf(stderr, "handle_get_kv: cache NEGATIVE for key='%s'\n", key);
+        mg_printf(conn, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n\r\nError 404: Not Found\nNot Found\n");
         free(key);
         return 1;
     } else {
         fprintf(stderr, "handle_get_kv: cache MISS for key='%s'\n", key);
     }
 
-    char *dbval = NULL;
-    int vlen = 0;
-    if (db_get(key, &dbval, &vlen) == 0) {
-        fprintf(stderr, "handle_get_kv: db_get OK for key='%s' len=%d\n", key, vlen);
-        cache_put(key, dbval);
-        mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"key\":\"%s\",\"value(DB)\":\"%s\"}\n", key, dbval);
-        free(dbval);
+    /* concurrent misses on one key share a single db_get */
+    flight_result_t fr;
+    int shared = 0;
+    rc = flight_do(key, ck.hash, fetch_from_db, &ck, &fr, &shared);
+    if (rc == 0) {
+        fprintf(stderr, "handle_get_kv: db_get OK for key='%s' len=%d%s\n", key, fr.len, shared ? " (shared)" : "");
+        send_value(conn, key, "value(DB)", fr.value, (size_t)fr.len);
+        free(fr.value);
         free(key);
         return 1;
     } else {
-        fprintf(stderr, "handle_get_kv: db_get NOTFOUND/ERROR for key='%s'\n", key);
+        fprintf(stderr, "handle_get_kv: db_get NOTFOUND/ERROR for key='%s'%s\n", key, shared ? " (shared)" : "");
+        free(fr.value);
         mg_printf(conn, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n\r\nError 404: Not Found\nNot Found\n");
         free(key);
         return 1;
@@ -259,8 +498,13 @@ static int handle_delete_kv(struct mg_connection *conn, void *cbdata) {
         return 1;
     }
 
-    int rc_db = db_delete(key);
-    (void)cache_delete(key);
+    cache_key_t ck;
+    cache_key_init(&ck, key);
+    unsigned long seq = cache_write_seq(&ck);
+    int rc_db = store_delete(key);
+    if (rc_db == 0) cache_delete_negative(&ck, seq);
+    else (void)cache_delete(&ck);
+    hotkeys_record(key, strlen(key), ck.hash, HOTKEY_WRITE);
 
     if (rc_db == 0) {
         mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"status\":\"deleted\"}\n");
@@ -271,13 +515,176 @@ static int handle_delete_kv(struct mg_connection *conn, void *cbdata) {
     return 1;
 }
 
+/* PUT /admin/cache?capacity=N&bytes=B resizes the cache in place; either
+   may be left out, 0 removes that limit, bytes takes K/M/G suffixes.
+   GET reports the current limits. */
+static int handle_admin_cache(struct mg_connection *conn, void *cbdata) {
+    (void)cbdata;
+    const struct mg_request_info *ri = mg_get_request_info(conn);
+    if (strcmp(ri->request_method, "PUT") == 0) {
+        const char *q = ri->query_string ? ri->query_string : "";
+        char buf[32];
+        size_t capacity = CACHE_KEEP, bytes = CACHE_KEEP;
+        int bad = 0;
+        if (mg_get_var(q, strlen(q), "capacity", buf, sizeof(buf)) >= 0 && cache_parse_size(buf, &capacity) != 0) bad = 1;
+        if (mg_get_var(q, strlen(q), "bytes", buf, sizeof(buf)) >= 0 && cache_parse_size(buf, &bytes) != 0) bad = 1;
+        if (bad || (capacity == CACHE_KEEP && bytes == CACHE_KEEP)) {
+            mg_printf(conn, "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\n\r\nExpected capacity=N and/or bytes=B\n");
+            return 1;
+        }
+        fprintf(stderr, "handle_admin_cache: resize %s\n", q);
+        cache_resize(capacity, bytes);
+    } else if (strcmp(ri->request_method, "GET") != 0) {
+        mg_printf(conn, "HTTP/1.1 405 Method Not Allowed\r\nContent-Type: text/plain\r\n\r\nMethod not allowed\n");
+        return 1;
+    }
+    cache_stats_t st;
+    cache_stats(&st);
+    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"capacity\":%lu,\"bytes\":%lu,\"items\":%lu,\"bytes_used\":%lu}\n",
+              st.capacity, st.bytes_limit, st.items, st.bytes_used);
+    return 1;
+}
+
 /* GET /metrics returns simple JSON stats */
 static int handle_metrics(struct mg_connection *conn, void *cbdata) {
     (void)cbdata;
-    unsigned long hits=0, misses=0, items=0;
-    cache_stats(&hits, &misses, &items);
-    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"cache_hits\":%lu,\"cache_misses\":%lu,\"cache_items\":%lu}\n",
-              hits, misses, items);
+    cache_stats_t st;
+    cache_stats(&st);
+    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"cache_hits\":%lu,\"cache_misses\":%lu,\"cache_items\":%lu,\"cache_policy\":\"%s\","
+              "\"cache_expired\":%lu,\"cache_negative_hits\":%lu,\"cache_negative_items\":%lu,\"cache_negative_bytes\":%lu,\"db_coalesced_waiters\":%lu,\"cache_stale_hits\":%lu,\"cache_l1_hits\":%lu,\"cache_refreshes\":%lu,\"cache_refresh_dropped\":%lu,\"cache_capacity\":%lu,\"cache_bytes_used\":%lu,\"cache_bytes_limit\":%lu,\"cache_index_slots\":%lu,\"cache_index_growing\":%lu",
+              st.hits, st.misses, st.items, cache_policy_name(), st.expired, st.neg_hits, st.neg_items, st.neg_bytes, flight_coalesced(), st.stale_hits, st.l1_hits, st.refreshes, st.refresh_dropped, st.capacity, st.bytes_used, st.bytes_limit,
+              st.index_slots, st.index_growing);
+    if (st.policy == CACHE_POLICY_TINYLFU) {
+        mg_printf(conn, ",\"tinylfu_window_items\":%lu,\"tinylfu_window_target\":%lu,\"tinylfu_main_items\":%lu",
+                  st.queue_items[0], st.queue_target[0], st.queue_items[1]);
+    } else if (st.policy == CACHE_POLICY_S3FIFO) {
+        mg_printf(conn, ",\"s3fifo_small_items\":%lu,\"s3fifo_small_target\":%lu,\"s3fifo_main_items\":%lu,\"s3fifo_ghost_items\":%lu",
+                  st.queue_items[0], st.queue_target[0], st.queue_items[1], st.ghost_items);
+    }
+    if (st.z_compressed || st.z_skipped) {
+        /* ratio over what is cached now; time per value compressed / hit decoded */
+        mg_printf(conn, ",\"cache_compressed_items\":%lu,\"cache_compressed_raw_bytes\":%lu,\"cache_compressed_bytes\":%lu,\"cache_compress_ratio\":%.2f,"
+                  "\"cache_compress_puts\":%lu,\"cache_compress_skipped\":%lu,\"cache_compress_ns_avg\":%.0f,\"cache_decompressions\":%lu,\"cache_decompress_ns_avg\":%.0f",
+                  st.z_items, st.z_raw_bytes, st.z_bytes, st.z_bytes ? (double)st.z_raw_bytes / st.z_bytes : 1.0,
+                  st.z_compressed, st.z_skipped, (double)st.z_encode_ns / (st.z_compressed + st.z_skipped),
+                  st.z_decoded, st.z_decoded ? (double)st.z_decode_ns / st.z_decoded : 0.0);
+    }
+    if (st.numa_nodes) {
+        mg_printf(conn, ",\"numa_nodes\":%d,\"numa_local_reads\":%lu,\"numa_remote_reads\":%lu,\"numa_shard_moves\":%lu",
+                  st.numa_nodes, st.numa_local, st.numa_remote, st.numa_moves);
+    }
+    if (wal_enabled()) {
+        wal_stats_t ws;
+        wal_stats(&ws);
+        mg_printf(conn, ",\"wal_records\":%lu,\"wal_syncs\":%lu,\"wal_pending\":%lu,\"wal_flushed\":%lu,\"wal_flush_errors\":%lu,\"wal_segments\":%lu",
+                  ws.records, ws.syncs, ws.pending, ws.flushed, ws.flush_errors, ws.segments);
+    }
+    unsigned long slab_bytes = 0;
+    mg_printf(conn, ",\"slab_classes\":[");
+    for (int i = 0, first = 1; i < st.nslab; ++i) {
+        const cache_slab_class_t *c = &st.slab[i];
+        if (!c->pages) continue;
+        mg_printf(conn, "%s{\"chunk_size\":%lu,\"pages\":%lu,\"used_chunks\":%lu,\"free_chunks\":%lu}",
+                  first ? "" : ",", c->chunk_size, c->pages, c->used_chunks, c->free_chunks);
+        slab_bytes += c->pages * st.slab_page_size;
+        first = 0;
+    }
+    mg_printf(conn, "],\"slab_bytes\":%lu,\"slab_large_items\":%lu,\"slab_large_bytes\":%lu}\n",
+              slab_bytes, st.slab_large_items, st.slab_large_bytes);
+    return 1;
+}
+
+/* GET /metrics/hotkeys lists the most requested keys, heaviest first:
+   recent rate, decayed request count (over by at most error) and how it
+   splits into cache hits, misses and writes */
+static int handle_metrics_hotkeys(struct mg_connection *conn, void *cbdata) {
+    (void)cbdata;
+    if (!hotkeys_enabled()) {
+        mg_printf(conn, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n\r\nHot-key tracking is off\n");
+        return 1;
+    }
+    hotkey_t *keys;
+    int n = hotkeys_top(&keys);
+    if (n < 0) {
+        mg_printf(conn, "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\n\r\nMemory error\n");
+        return 1;
+    }
+    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"half_life_s\":%d,\"keys\":[",
+              HOTKEYS_HALF_LIFE_S);
+    for (int i = 0; i < n; ++i) {
+        const hotkey_t *h = &keys[i];
+        mg_printf(conn, "%s{\"key\":\"", i ? "," : "");
+        write_json_string(conn, h->key, h->len);
+        mg_printf(conn, "\",\"rate\":%.1f,\"requests\":%lu,\"error\":%lu,\"hits\":%lu,\"misses\":%lu,\"writes\":%lu,\"hot\":%s}",
+                  h->rate, h->count, h->error, h->hits, h->misses, h->writes, h->hot ? "true" : "false");
+    }
+    mg_printf(conn, "]}\n");
+    hotkeys_release(keys, n);
+    return 1;
+}
+
+/* non-empty size buckets as [{"lt":upper bound,"entries":n,"bytes":b},...] */
+static void write_size_buckets(struct mg_connection *conn, const cache_size_bucket_t *b) {
+    mg_printf(conn, "[");
+    for (int i = 0, first = 1; i < CACHE_DEBUG_SIZE_BUCKETS; ++i) {
+        if (!b[i].entries) continue;
+        if (i == CACHE_DEBUG_SIZE_BUCKETS - 1) mg_printf(conn, "%s{\"lt\":null", first ? "" : ",");
+        else mg_printf(conn, "%s{\"lt\":%lu", first ? "" : ",", 1UL << i);
+        mg_printf(conn, ",\"entries\":%lu,\"bytes\":%lu}", b[i].entries, b[i].bytes);
+        first = 0;
+    }
+    mg_printf(conn, "]");
+}
+
+static void write_history(struct mg_connection *conn, const unsigned long *h, int n) {
+    mg_printf(conn, "[");
+    for (int i = 0; i < n; ++i) mg_printf(conn, "%s%lu", i ? "," : "", h[i]);
+    mg_printf(conn, "]");
+}
+
+/* GET /debug/cache breaks the cache's memory down from a walk over every
+   entry: key and value size histograms (lengths below each "lt", null for
+   the open-ended last one), payload against header, chunk slack and free
+   slab space, index load and probe lengths, and evictions per interval.
+   Writers to each shard wait while it is walked. */
+static int handle_debug_cache(struct mg_connection *conn, void *cbdata) {
+    (void)cbdata;
+    cache_debug_t d;
+    if (cache_debug(&d) != 0) {
+        mg_printf(conn, "HTTP/1.1 503 Service Unavailable\r\nContent-Type: text/plain\r\n\r\nNo cache\n");
+        return 1;
+    }
+    unsigned long total = d.slab_page_bytes + d.large_bytes + d.index_bytes;
+    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"entries\":%lu,\"negative_entries\":%lu,\"retired_entries\":%lu",
+              d.entries, d.neg_entries, d.retired);
+    mg_printf(conn, ",\"memory\":{\"total_bytes\":%lu,\"payload_bytes\":%lu,\"header_bytes\":%lu,\"slack_bytes\":%lu,\"slab_page_bytes\":%lu,"
+              "\"slab_free_bytes\":%lu,\"large_bytes\":%lu,\"index_bytes\":%lu,\"payload_pct\":%.1f}",
+              total, d.payload_bytes, d.header_bytes, d.slack_bytes, d.slab_page_bytes, d.slab_free_bytes, d.large_bytes,
+              d.index_bytes, total ? 100.0 * d.payload_bytes / total : 0.0);
+    mg_printf(conn, ",\"key_sizes\":");
+    write_size_buckets(conn, d.key_sizes);
+    mg_printf(conn, ",\"value_sizes\":");
+    write_size_buckets(conn, d.value_sizes);
+    unsigned long probed = 0, found = 0;
+    for (int i = 0; i < CACHE_DEBUG_PROBE_BUCKETS; ++i) {
+        probed += d.probe[i] * (unsigned long)(i + 1);
+        found += d.probe[i];
+    }
+    mg_printf(conn, ",\"index\":{\"slots\":%lu,\"used\":%lu,\"tombstones\":%lu,\"load_factor\":%.3f,\"growing_shards\":%lu,"
+              "\"probe_groups_mean\":%.2f,\"probe_groups_max\":%lu,\"probe_groups\":[",
+              d.index_slots, d.index_used, d.index_tombstones,
+              d.index_slots ? (double)(d.index_used + d.index_tombstones) / d.index_slots : 0.0, d.index_growing,
+              found ? (double)probed / found : 0.0, d.probe_max);
+    /* entries found in the 1st, 2nd, ... group probed; the last counts that many or more */
+    int last = CACHE_DEBUG_PROBE_BUCKETS;
+    while (last > 1 && !d.probe[last - 1]) last--;
+    for (int i = 0; i < last; ++i) mg_printf(conn, "%s%lu", i ? "," : "", d.probe[i]);
+    mg_printf(conn, "]},\"evictions\":{\"total\":%lu,\"expired\":%lu,\"interval_s\":%d,\"recent\":",
+              d.evictions, d.expired, CACHE_DEBUG_INTERVAL_S);
+    write_history(conn, d.evict_history, d.nhistory);
+    mg_printf(conn, ",\"recent_expired\":");
+    write_history(conn, d.expire_history, d.nhistory);
+    mg_printf(conn, "}}\n");
     return 1;
 }
 
@@ -305,6 +712,11 @@ static int kv_dispatch(struct mg_connection *conn, void *cbdata) {
         return handle_get_kv(conn, cbdata);
     }
 
+    /* PUT /kv/<key> with the raw value as body */
+    if (strcmp(method, "PUT") == 0) {
+        return handle_put_kv(conn, cbdata);
+    }
+
     /* DELETE /kv/<key> */
     if (strcmp(method, "DELETE") == 0) {
         return handle_delete_kv(conn, cbdata);
@@ -315,11 +727,21 @@ static int kv_dispatch(struct mg_connection *conn, void *cbdata) {
 }
 
 
+/* civetweb thread start hook (NUMA mode): spread request workers evenly
+   over the nodes, so every node's shards have local readers */
+static void *pin_worker(const struct mg_context *c, int thread_type) {
+    (void)c;
+    if (thread_type == 1) numa_pin_next(); /* 1 = worker */
+    return NULL;
+}
+
 /* global context for civetweb */
 static struct mg_context *ctx = NULL;
+static const char *snapshot_path = NULL; /* cache saved here on shutdown */
 
-int start_http_server(const char *bind_addr, int port, int num_threads, int cache_capacity,
-                      const char *db_conninfo, int db_pool_size)
+int start_http_server(const char *bind_addr, int port, int num_threads, const cache_config_t *cache_cfg,
+                      const char *db_conninfo, int db_pool_size, long cache_warmup,
+                      const char *wal_prefix, unsigned long wal_flush_ms, int hotkeys)
 {
     (void)num_threads;
     char ports[64];
@@ -343,18 +765,29 @@ int start_http_server(const char *bind_addr, int port, int num_threads, int cach
     }
 
     /* initialize cache first */
-    if (cache_init((size_t)cache_capacity) != 0) {
+    cache_config_t cfg = *cache_cfg;
+    cfg.refresh = refresh_from_db;
+    snapshot_path = cache_cfg->snapshot_path;
+    if (cache_init(&cfg) != 0) {
         fprintf(stderr, "cache_init failed\n");
         return -1;
     }
 
+    if (hotkeys > 0 && hotkeys_init(hotkeys) != 0) {
+        fprintf(stderr, "hotkeys_init failed\n");
+        cache_free();
+        return -1;
+    }
+
     /* Start civetweb FIRST so we can isolate Civet errors from DB errors */
     static struct mg_callbacks callbacks;
     memset(&callbacks, 0, sizeof(callbacks));
+    if (cache_cfg->numa) callbacks.init_thread = pin_worker;
     ctx = mg_start(&callbacks, NULL, options);
     if (!ctx) {
         int err = errno;
         fprintf(stderr, "mg_start failed: errno=%d (%s). Check /tmp/civet_error.log for details\n", err, strerror(err));
+        hotkeys_free();
         cache_free();
         return -1;
     }
@@ -364,13 +797,44 @@ int start_http_server(const char *bind_addr, int port, int num_threads, int cach
     /* Now initialize DB; if it fails, log error but keep server running */
     if (db_init(db_conninfo, db_pool_size) != 0) {
         fprintf(stderr, "Warning: db_init failed — server is running but DB unavailable. Check DB settings/logs.\n");
+        if (wal_prefix) {
+            /* the log must be replayed before anything is served */
+            fprintf(stderr, "write-back mode needs the database at startup\n");
+            mg_stop(ctx);
+            ctx = NULL;
+            hotkeys_free();
+            cache_free();
+            return -1;
+        }
     } else {
         printf("DB pool initialized (size=%d)\n", db_pool_size);
+        if (wal_prefix) {
+            /* replays writes a previous run acknowledged but never flushed */
+            if (wal_open(wal_prefix, wal_flush_ms) != 0) {
+                fprintf(stderr, "write-back log %s could not be opened\n", wal_prefix);
+                mg_stop(ctx);
+                ctx = NULL;
+                hotkeys_free();
+                cache_free();
+                db_shutdown();
+                return -1;
+            }
+            printf("write-back mode: logging writes to %s.*\n", wal_prefix);
+        }
+        if (cache_warmup > 0) {
+            /* before any handler exists: the first request already finds a warm cache */
+            long n = db_warmup(cache_warmup, warm_put, NULL);
+            if (n < 0) fprintf(stderr, "Warning: cache warm-up failed\n");
+            else printf("cache warm-up: loaded %ld rows\n", n);
+        }
     }
 
     mg_set_request_handler(ctx, "/kv", kv_dispatch, NULL);
     mg_set_request_handler(ctx, "/kv/", kv_dispatch, NULL);
     mg_set_request_handler(ctx, "/metrics", handle_metrics, NULL);
+    mg_set_request_handler(ctx, "/metrics/hotkeys", handle_metrics_hotkeys, NULL);
+    mg_set_request_handler(ctx, "/admin/cache", handle_admin_cache, NULL);
+    mg_set_request_handler(ctx, "/debug/cache", handle_debug_cache, NULL);
 
     return 0;
 }
@@ -380,6 +844,16 @@ void stop_http_server(void) {
         mg_stop(ctx);
         ctx = NULL;
     }
-    db_shutdown();
+    hotkeys_free();
+    if (snapshot_path) {
+        /* no handler runs after mg_stop, so this is the final state */
+        int n = cache_snapshot_save(snapshot_path);
+        if (n < 0) fprintf(stderr, "cache snapshot to %s failed\n", snapshot_path);
+        else fprintf(stderr, "cache: saved %d entries to %s\n", n, snapshot_path);
+    }
+    /* the cache's refresher may be inside db_get: stop it first */
     cache_free();
+    /* flushes the write-back log, so before the pool goes */
+    wal_close();
+    db_shutdown();
 }
@@ -1,8 +1,11 @@
 #ifndef HTTP_H
 #define HTTP_H
 
-int start_http_server(const char *bind_addr, int port, int num_threads, int cache_capacity,
-                      const char *db_conninfo, int db_pool_size);
+#include "cache.h"
+
+int start_http_server(const char *bind_addr, int port, int num_threads, const cache_config_t *cache_cfg,
+                      const char *db_conninfo, int db_pool_size, long cache_warmup,
+                      const char *wal_prefix, unsigned long wal_flush_ms, int hotkeys);
 void stop_http_server(void);
 
 #endif
@@ -0,0 +1,161 @@
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5 /* the block always ends in this many literals */
+#define MF_LIMIT 12     /* no match starts closer than this to the end */
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+#define SKIP_SHIFT 6    /* probe every other byte after 64 misses in a row, and so on */
+
+/* A literal run of up to SHORT_COPY bytes is copied as one fixed
+   SHORT_COPY-byte block when both buffers have that much room left. The
+   extra bytes written land where the rest of the output goes. The extra
+   bytes read stay in the buffer: the decoder checks, and the encoder
+   only does this for a run that ends in a match, which has MF_LIMIT >=
+   SHORT_COPY input bytes after it. */
+#define SHORT_COPY 8
+
+static inline uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline __attribute__((unused)) uint64_t read64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* a length past what fits in a nibble: runs of 255 then the rest */
+static char *put_len(char *op, char *end, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op >= end) return NULL;
+        *op++ = (char)255;
+    }
+    if (op >= end) return NULL;
+    *op++ = (char)len;
+    return op;
+}
+
+/* one sequence: literals [lit, lit + nlit), then a match of mlen at off
+   (mlen 0: the final, literals-only sequence) */
+static char *put_seq(char *op, char *end, const char *lit, size_t nlit, size_t off, size_t mlen) {
+    if (op >= end) return NULL;
+    char *token = op++;
+    size_t ml = mlen ? mlen - MIN_MATCH : 0;
+    *token = (char)(((nlit < 15 ? nlit : 15) << 4) | (ml < 15 ? ml : 15));
+    if (nlit >= 15 && !(op = put_len(op, end, nlit - 15))) return NULL;
+    if ((size_t)(end - op) < nlit) return NULL;
+    if (mlen && nlit <= SHORT_COPY && end - op >= SHORT_COPY) memcpy(op, lit, SHORT_COPY);
+    else memcpy(op, lit, nlit);
+    op += nlit;
+    if (!mlen) return op;
+    if (end - op < 2) return NULL;
+    *op++ = (char)(off & 0xff);
+    *op++ = (char)(off >> 8);
+    if (ml >= 15 && !(op = put_len(op, end, ml - 15))) return NULL;
+    return op;
+}
+
+size_t lz_compress(const char *src, size_t n, char *dst, size_t cap) {
+    char *op = dst, *end = dst + cap;
+    size_t anchor = 0;
+    if (n >= MF_LIMIT + 1) {
+        /* position + 1 of the last place each hash was seen, 0 = none */
+        uint32_t table[1 << HASH_BITS];
+        memset(table, 0, sizeof(table));
+        size_t ip = 0, limit = n - MF_LIMIT, misses = 0;
+        while (ip <= limit) {
+            uint32_t v = read32(src + ip);
+            unsigned h = hash4(v);
+            size_t ref = table[h];
+            table[h] = (uint32_t)(ip + 1);
+            if (!ref || ip + 1 - ref > MAX_OFFSET || read32(src + ref - 1) != v) {
+                ip += 1 + (misses++ >> SKIP_SHIFT);
+                continue;
+            }
+            ref--;
+            misses = 0;
+            /* widen the match backwards over literals, then forwards */
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            size_t mlen = MIN_MATCH, mmax = n - LAST_LITERALS - ip;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            /* 8 bytes per compare; the lowest differing byte ends the match */
+            while (mlen + 8 <= mmax) {
+                uint64_t d = read64(src + ip + mlen) ^ read64(src + ref + mlen);
+                if (d) {
+                    mlen += (size_t)__builtin_ctzll(d) >> 3;
+                    mmax = mlen;
+                    break;
+                }
+                mlen += 8;
+            }
+#endif
+            while (mlen < mmax && src[ip + mlen] == src[ref + mlen]) mlen++;
+            if (!(op = put_seq(op, end, src + anchor, ip - anchor, ip - ref, mlen))) return 0;
+            ip += mlen;
+            anchor = ip;
+            /* the position just before the next search seeds the table */
+            if (ip - 2 <= limit) table[hash4(read32(src + ip - 2))] = (uint32_t)(ip - 1);
+        }
+    }
+    if (!(op = put_seq(op, end, src + anchor, n - anchor, 0, 0))) return 0;
+    return (size_t)(op - dst);
+}
+
+/* read an extended length onto *len; -1 past the end of the block */
+static int get_len(const unsigned char **ip, const unsigned char *end, size_t *len) {
+    unsigned b;
+    do {
+        if (*ip >= end) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz_decompress(const char *src, size_t n, char *dst, size_t out_len) {
+    const unsigned char *ip = (const unsigned char *)src, *iend = ip + n;
+    char *op = dst, *oend = dst + out_len;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && get_len(&ip, iend, &nlit) != 0) return -1;
+        if (nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op)) return -1;
+        if (nlit <= SHORT_COPY && iend - ip >= SHORT_COPY && oend - op >= SHORT_COPY) memcpy(op, ip, SHORT_COPY);
+        else memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == iend) break; /* the last sequence has no match */
+        if (iend - ip < 2) return -1;
+        size_t off = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && get_len(&ip, iend, &mlen) != 0) return -1;
+        mlen += MIN_MATCH;
+        if (!off || off > (size_t)(op - dst) || mlen > (size_t)(oend - op)) return -1;
+        const char *m = op - off;
+        if (off >= 8 && (size_t)(oend - op) >= mlen + 8) {
+            /* 8 bytes at a time, each read from bytes already written */
+            for (size_t i = 0; i < mlen; i += 8) memcpy(op + i, m + i, 8);
+            op += mlen;
+        } else if (off >= mlen) {
+            memcpy(op, m, mlen);
+            op += mlen;
+        } else {
+            /* overlapping: a short period repeated, byte by byte */
+            for (size_t i = 0; i < mlen; ++i) *op++ = m[i];
+        }
+    }
+    return op == oend ? 0 : -1;
+}
@@ -0,0 +1,26 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/*
+ Small LZ77 block codec in the LZ4 block format: sequences of a token,
+ literal bytes and a 16-bit back offset, found with one hash probe per
+ position. Meant for cache values: fast on both sides rather than tight,
+ with a decoder that checks every length and offset against the buffers
+ it is given. A block does not record its decoded length; the caller
+ keeps it.
+*/
+
+/* worst-case compressed size of n bytes */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+/* compress n bytes of src into dst (cap bytes); returns the compressed
+   length, or 0 if it did not fit in cap */
+size_t lz_compress(const char *src, size_t n, char *dst, size_t cap);
+
+/* decode a block of n bytes into exactly out_len bytes of dst;
+   0 on success, -1 if the block is malformed or decodes to another length */
+int lz_decompress(const char *src, size_t n, char *dst, size_t out_len);
+
+#endif
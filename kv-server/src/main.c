@@ -2,10 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include "http.h"
+#include "db.h"
 
 static void usage(const char *p) {
     fprintf(stderr,
-        "Usage: %s [--bind 0.0.0.0] [--port 8080] [--threads 8] [--cache_capacity 10000] [--db_conn \"...\" ] [--db_pool 4]\n",
+        "Usage: %s [--bind 0.0.0.0] [--port 8080] [--threads 8] [--cache_capacity 10000] [--cache_bytes 256M] [--cache_shards 16] [--cache_policy lru|clock|tinylfu|s3fifo] [--cache_small_pct 10] [--cache_neg_ttl 0] [--cache_neg_bytes 1M] [--cache_refresh_ms 0] [--cache_stale_ms 10000] [--cache_snapshot FILE] [--cache_warmup N] [--cache_l1 0] [--cache_compress 0] [--numa] [--db_conn \"...\" ] [--db_pool 4] [--db_sweep_interval 10] [--write_back PREFIX] [--wal_flush_ms 100] [--hotkeys 32]\n",
         p);
 }
 
@@ -14,16 +15,52 @@ int main(int argc, char **argv) {
     int port = 8080;
     int threads = 8;
     int cache_capacity = 10000;
+    size_t cache_bytes = 0;
+    int cache_shards = 16;
+    cache_policy_t cache_policy = CACHE_POLICY_LRU;
+    int cache_small_pct = 10;
+    long cache_neg_ttl = 0; /* ms a store miss is remembered, 0 = off */
+    size_t cache_neg_bytes = 1 << 20;
+    long cache_refresh_ms = 0; /* refresh-ahead after this long, 0 = off */
+    long cache_stale_ms = 10000;
+    const char *cache_snapshot = NULL; /* warm restart file, NULL = off */
+    long cache_warmup = 0; /* rows to preload from the database, 0 = off */
+    long cache_l1 = 0; /* per-thread near-cache slots, 0 = off */
+    size_t cache_compress = 0; /* compress values from this size up, 0 = off */
+    int numa = 0; /* per-node cache memory and pinned workers */
     const char *db_conninfo = "host=127.0.0.1 port=5432 user=kvuser password=kvpass dbname=kvdb";
     int db_pool = 4;
+    int db_sweep_interval = 10; /* seconds between expired-row sweeps, 0 = off */
+    const char *write_back = NULL; /* write-back log prefix, NULL = write through */
+    long wal_flush_ms = 100;
+    long hotkeys = 32; /* keys listed at /metrics/hotkeys, 0 = no tracking */
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--bind") == 0 && i + 1 < argc) { bind_addr = argv[++i]; }
         else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) { port = atoi(argv[++i]); }
         else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) { threads = atoi(argv[++i]); }
         else if (strcmp(argv[i], "--cache_capacity") == 0 && i + 1 < argc) { cache_capacity = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--cache_bytes") == 0 && i + 1 < argc) { if (cache_parse_size(argv[++i], &cache_bytes) != 0) { usage(argv[0]); return 1; } }
+        else if (strcmp(argv[i], "--cache_shards") == 0 && i + 1 < argc) { cache_shards = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--cache_policy") == 0 && i + 1 < argc) {
+            if (cache_policy_parse(argv[++i], &cache_policy) != 0) { usage(argv[0]); return 1; }
+        }
+        else if (strcmp(argv[i], "--cache_small_pct") == 0 && i + 1 < argc) { cache_small_pct = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--cache_neg_ttl") == 0 && i + 1 < argc) { cache_neg_ttl = atol(argv[++i]); }
+        else if (strcmp(argv[i], "--cache_neg_bytes") == 0 && i + 1 < argc) { if (cache_parse_size(argv[++i], &cache_neg_bytes) != 0) { usage(argv[0]); return 1; } }
+        else if (strcmp(argv[i], "--cache_refresh_ms") == 0 && i + 1 < argc) { cache_refresh_ms = atol(argv[++i]); }
+        else if (strcmp(argv[i], "--cache_stale_ms") == 0 && i + 1 < argc) { cache_stale_ms = atol(argv[++i]); }
+        else if (strcmp(argv[i], "--cache_snapshot") == 0 && i + 1 < argc) { cache_snapshot = argv[++i]; }
+        else if (strcmp(argv[i], "--cache_warmup") == 0 && i + 1 < argc) { cache_warmup = atol(argv[++i]); }
+        else if (strcmp(argv[i], "--cache_l1") == 0 && i + 1 < argc) { cache_l1 = atol(argv[++i]); }
+        else if (strcmp(argv[i], "--cache_compress") == 0 && i + 1 < argc) { if (cache_parse_size(argv[++i], &cache_compress) != 0) { usage(argv[0]); return 1; } }
+        else if (strcmp(argv[i], "--numa") == 0) { numa = 1; }
         else if (strcmp(argv[i], "--db_conn") == 0 && i + 1 < argc) { db_conninfo = argv[++i]; }
         else if (strcmp(argv[i], "--db_pool") == 0 && i + 1 < argc) { db_pool = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--db_sweep_interval") == 0 && i + 1 < argc) { db_sweep_interval = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--write_back") == 0 && i + 1 < argc) { write_back = argv[++i]; }
+        else if (strcmp(argv[i], "--wal_flush_ms") == 0 && i + 1 < argc) { wal_flush_ms = atol(argv[++i]); }
+        else if (strcmp(argv[i], "--hotkeys") == 0 && i + 1 < argc) { hotkeys = atol(argv[++i]); }
         else { usage(argv[0]); return 1; }
     }
 
@@ -44,13 +81,33 @@ int main(int argc, char **argv) {
     return 0;
     */
 
-    fprintf(stderr, "Starting KV server on %s:%d (threads=%d, cache=%d, db_pool=%d)\n",
-           bind_addr, port, threads, cache_capacity, db_pool);
+    fprintf(stderr, "Starting KV server on %s:%d (threads=%d, cache=%d, shards=%d, db_pool=%d)\n",
+           bind_addr, port, threads, cache_capacity, cache_shards, db_pool);
 
-    if (start_http_server(bind_addr, port, threads, cache_capacity, db_conninfo, db_pool) != 0) {
+    cache_config_t cache_cfg = {
+        .capacity = cache_capacity > 0 ? (size_t)cache_capacity : 0,
+        .bytes = cache_bytes,
+        .nshards = cache_shards > 0 ? (size_t)cache_shards : 1,
+        .policy = cache_policy,
+        .small_pct = cache_small_pct > 0 ? (size_t)cache_small_pct : 0,
+        .neg_ttl_ms = cache_neg_ttl > 0 ? (unsigned long)cache_neg_ttl : 0,
+        .neg_bytes = cache_neg_bytes,
+        .refresh_ms = cache_refresh_ms > 0 ? (unsigned long)cache_refresh_ms : 0,
+        .stale_ms = cache_stale_ms > 0 ? (unsigned long)cache_stale_ms : 0,
+        .snapshot_path = cache_snapshot,
+        .numa = numa,
+        .l1_slots = cache_l1 > 0 ? (size_t)cache_l1 : 0,
+        .compress_min = cache_compress,
+    };
+
+    if (start_http_server(bind_addr, port, threads, &cache_cfg, db_conninfo, db_pool, cache_warmup,
+                          write_back, wal_flush_ms > 0 ? (unsigned long)wal_flush_ms : 100,
+                          hotkeys > 0 ? (int)hotkeys : 0) != 0) {
         fprintf(stderr, "Failed to start server\n");
         return 1;
     }
+    if (db_sweep_interval > 0 && db_sweeper_start(db_sweep_interval) != 0)
+        fprintf(stderr, "Failed to start expired-row sweeper\n");
 
     /* The civetweb server runs until killed. This process just waits here. */
     fprintf(stderr, "Press Enter to stop server...\n");
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include "numa.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static pthread_once_t topo_once = PTHREAD_ONCE_INIT;
+static int nnodes = 1;
+static int kernel_id[NUMA_MAX_NODES];           /* dense node -> kernel node id */
+static cpu_set_t node_cpus[NUMA_MAX_NODES];
+static unsigned char cpu_node[CPU_SETSIZE];     /* cpu -> dense node, 0 if unknown */
+static atomic_uint next_pin = 0;
+
+static __thread int my_node = -1;
+static __thread int my_pinned;
+static __thread unsigned my_calls;
+
+/* parse a sysfs cpu list such as "0-3,8-11" into set */
+static void parse_cpulist(const char *s, cpu_set_t *set) {
+    while (*s) {
+        char *end;
+        long a = strtol(s, &end, 10);
+        if (end == s) break;
+        long b = a;
+        if (*end == '-') b = strtol(end + 1, &end, 10);
+        for (long c = a; c <= b && c < CPU_SETSIZE; ++c)
+            if (c >= 0) CPU_SET(c, set);
+        s = *end == ',' ? end + 1 : end;
+        if (isspace((unsigned char)*s)) break;
+    }
+}
+
+static int cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static void topo_read(void) {
+    DIR *d = opendir("/sys/devices/system/node");
+    if (!d) return;
+    int ids[NUMA_MAX_NODES], n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) && n < NUMA_MAX_NODES) {
+        if (strncmp(de->d_name, "node", 4) != 0 || !isdigit((unsigned char)de->d_name[4])) continue;
+        ids[n++] = atoi(de->d_name + 4);
+    }
+    closedir(d);
+    if (n < 2) return; /* one node: nothing to place */
+    qsort(ids, n, sizeof(ids[0]), cmp_int);
+    int found = 0;
+    for (int i = 0; i < n; ++i) {
+        char path[64], line[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (fgets(line, sizeof(line), f)) parse_cpulist(line, &set);
+        fclose(f);
+        if (!CPU_COUNT(&set)) continue; /* memory-only node: no threads to pin there */
+        kernel_id[found] = ids[i];
+        node_cpus[found] = set;
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &set)) cpu_node[c] = (unsigned char)found;
+        found++;
+    }
+    if (found > 1) nnodes = found;
+    else memset(cpu_node, 0, sizeof(cpu_node));
+}
+
+int numa_topo_init(void) {
+    pthread_once(&topo_once, topo_read);
+    return nnodes;
+}
+
+int numa_node_count(void) {
+    return numa_topo_init();
+}
+
+int numa_this_node(void) {
+    if (my_pinned) return my_node;
+    /* unpinned threads can migrate; an occasional sched_getcpu keeps up */
+    if (my_node < 0 || (++my_calls & 1023) == 0) {
+        numa_topo_init();
+        int cpu = sched_getcpu();
+        my_node = cpu >= 0 && cpu < CPU_SETSIZE ? cpu_node[cpu] : 0;
+    }
+    return my_node;
+}
+
+int numa_pin_next(void) {
+    if (numa_topo_init() < 2) return -1;
+    int node = (int)(atomic_fetch_add(&next_pin, 1) % (unsigned)nnodes);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &node_cpus[node]) != 0) return -1;
+    my_node = node;
+    my_pinned = 1;
+    return node;
+}
+
+static long do_mbind(void *p, size_t len, int node, unsigned flags) {
+    unsigned long mask = 1UL << kernel_id[node];
+    /* maxnode counts one past the highest bit the kernel should read */
+    return syscall(SYS_mbind, p, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, flags);
+}
+
+void *numa_mem_alloc(size_t len, int node) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    /* before first touch, so pages are allocated there to begin with; a
+       refusal (e.g. a container without the capability) only costs locality */
+    if (node >= 0 && node < numa_topo_init() && nnodes > 1) do_mbind(p, len, node, 0);
+    return p;
+}
+
+void numa_mem_free(void *p, size_t len) {
+    if (p) munmap(p, len);
+}
+
+int numa_mem_move(void *p, size_t len, int node) {
+    if (node < 0 || node >= numa_topo_init()) return -1;
+    if (nnodes < 2) return 0;
+    return do_mbind(p, len, node, MPOL_MF_MOVE) == 0 ? 0 : -1;
+}
@@ -0,0 +1,36 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+
+/*
+ Minimal NUMA support without libnuma: the topology comes from
+ /sys/devices/system/node, memory placement from the mbind system call.
+ Nodes are numbered densely from 0 here (the kernel's ids may have gaps).
+ Where the platform has no NUMA information everything runs as node 0,
+ and placement calls are no-ops.
+*/
+
+#define NUMA_MAX_NODES 16
+
+/* read the topology; safe to call more than once. Returns the node count. */
+int numa_topo_init(void);
+int numa_node_count(void);
+
+/* node of the CPU the calling thread runs on: fixed once the thread is
+   pinned, otherwise looked up again every so many calls */
+int numa_this_node(void);
+
+/* pin the calling thread to the CPUs of the next node in turn, so that
+   successive callers spread evenly; returns the node, -1 if not pinned */
+int numa_pin_next(void);
+
+/* Page-granular memory preferring node (mmap'd, zero filled); node < 0
+   leaves placement to the kernel. NULL on failure. */
+void *numa_mem_alloc(size_t len, int node);
+void numa_mem_free(void *p, size_t len);
+
+/* migrate a numa_mem_alloc'd range to node and keep it there; 0 on success */
+int numa_mem_move(void *p, size_t len, int node);
+
+#endif
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include "slab.h"
+#include "numa.h"
+#include <stdlib.h>
+#include <string.h>
+
+void slab_init(slab_t *sl) {
+    memset(sl, 0, sizeof(*sl));
+    sl->node = -1;
+    double size = SLAB_MIN_CHUNK;
+    while (sl->nclasses < SLAB_MAX_CLASSES) {
+        size_t cs = ((size_t)size + 7) & ~(size_t)7; /* keep chunks 8-byte aligned */
+        if (cs >= SLAB_MAX_CHUNK || sl->nclasses == SLAB_MAX_CLASSES - 1) cs = SLAB_MAX_CHUNK;
+        slab_class_t *c = &sl->classes[sl->nclasses++];
+        c->chunk_size = cs;
+        c->per_page = SLAB_PAGE_SIZE / cs;
+        if (cs == SLAB_MAX_CHUNK) break;
+        size *= SLAB_GROWTH;
+    }
+}
+
+void slab_destroy(slab_t *sl) {
+    for (int i = 0; i < sl->nclasses; ++i) {
+        slab_class_t *c = &sl->classes[i];
+        if (sl->node < 0)
+            for (size_t p = 0; p < c->npages; ++p) free(c->pages[p]);
+        free(c->pages);
+    }
+    for (size_t a = 0; a < sl->narenas; ++a) numa_mem_free(sl->arenas[a], SLAB_ARENA_SIZE);
+    free(sl->arenas);
+    free(sl->dir);
+    free(sl->large);
+    memset(sl, 0, sizeof(*sl));
+    sl->node = -1;
+}
+
+void slab_set_node(slab_t *sl, int node) {
+    sl->node = node;
+}
+
+int slab_move(slab_t *sl, int node) {
+    if (sl->node < 0 || node < 0) return -1;
+    int rc = 0;
+    for (size_t a = 0; a < sl->narenas; ++a)
+        if (numa_mem_move(sl->arenas[a], SLAB_ARENA_SIZE, node) != 0) rc = -1;
+    sl->node = node; /* new arenas go there either way */
+    return rc;
+}
+
+/* next page from the newest arena, starting a new one on sl->node if it is used up */
+static char *arena_page(slab_t *sl) {
+    if (!sl->narenas || sl->arena_used == SLAB_ARENA_SIZE) {
+        if (sl->narenas == sl->arenas_cap) {
+            size_t ncap = sl->arenas_cap ? sl->arenas_cap * 2 : 8;
+            void **na = realloc(sl->arenas, ncap * sizeof(void *));
+            if (!na) return NULL;
+            sl->arenas = na;
+            sl->arenas_cap = ncap;
+        }
+        void *a = numa_mem_alloc(SLAB_ARENA_SIZE, sl->node);
+        if (!a) return NULL;
+        sl->arenas[sl->narenas++] = a;
+        sl->arena_used = 0;
+    }
+    char *page = (char *)sl->arenas[sl->narenas - 1] + sl->arena_used;
+    sl->arena_used += SLAB_PAGE_SIZE;
+    return page;
+}
+
+int slab_class_for(const slab_t *sl, size_t size) {
+    if (size > SLAB_MAX_CHUNK) return SLAB_LARGE;
+    /* few classes: a linear scan beats anything clever */
+    for (int i = 0; i < sl->nclasses; ++i)
+        if (size <= sl->classes[i].chunk_size) return i;
+    return SLAB_LARGE;
+}
+
+size_t slab_alloc_size(const slab_t *sl, int cls, size_t size) {
+    return cls == SLAB_LARGE ? size : sl->classes[cls].chunk_size;
+}
+
+/* make room for one more pointer in an array doubling from 4 */
+static int reserve(void ***arr, size_t n, size_t *cap) {
+    if (n < *cap) return 0;
+    size_t ncap = *cap ? *cap * 2 : 4;
+    void **na = realloc(*arr, ncap * sizeof(void *));
+    if (!na) return -1;
+    *arr = na;
+    *cap = ncap;
+    return 0;
+}
+
+/* carve a fresh page into chunks on the class free list */
+static int grow_class(slab_t *sl, slab_class_t *c) {
+    if (!sl->ndir) sl->ndir = 1; /* handle 0 means none */
+    if (sl->ndir > SLAB_MAX_PAGES || reserve(&c->pages, c->npages, &c->pages_cap) != 0 ||
+        reserve(&sl->dir, sl->ndir, &sl->dir_cap) != 0)
+        return -1;
+    char *page = sl->node < 0 ? malloc(SLAB_PAGE_SIZE) : arena_page(sl);
+    if (!page) return -1;
+    c->pages[c->npages++] = page;
+    slab_h base = (slab_h)sl->ndir << SLAB_H_OFF_BITS;
+    sl->dir[sl->ndir++] = page;
+    /* pushed backwards so chunks go out in address order */
+    for (size_t i = c->per_page; i-- > 0;) {
+        size_t off = i * c->chunk_size;
+        *(slab_h *)(page + off) = c->free_list;
+        c->free_list = base | (slab_h)(off >> 3);
+    }
+    c->free_chunks += c->per_page;
+    return 0;
+}
+
+void *slab_alloc(slab_t *sl, int cls, slab_h *h) {
+    slab_class_t *c = &sl->classes[cls];
+    if (!c->free_list && grow_class(sl, c) != 0) return NULL;
+    *h = c->free_list;
+    void *p = slab_ptr(sl, *h);
+    c->free_list = *(slab_h *)p;
+    c->free_chunks--;
+    c->used++;
+    return p;
+}
+
+void slab_free(slab_t *sl, int cls, void *p, slab_h h) {
+    slab_class_t *c = &sl->classes[cls];
+    *(slab_h *)p = c->free_list;
+    c->free_list = h;
+    c->free_chunks++;
+    c->used--;
+}
+
+slab_h slab_large_add(slab_t *sl, void *p) {
+    size_t i;
+    if (sl->large_free) {
+        i = sl->large_free - 1;
+        sl->large_free = (uintptr_t)sl->large[i] >> 1;
+    } else {
+        if (sl->nlarge >= SLAB_H_LARGE - 1 || reserve(&sl->large, sl->nlarge, &sl->large_cap) != 0) return 0;
+        i = sl->nlarge++;
+    }
+    sl->large[i] = p;
+    return SLAB_H_LARGE | (slab_h)i;
+}
+
+void slab_large_del(slab_t *sl, slab_h h) {
+    size_t i = h & ~SLAB_H_LARGE;
+    /* odd, so never mistaken for an allocation */
+    sl->large[i] = (void *)(((uintptr_t)sl->large_free << 1) | 1);
+    sl->large_free = i + 1;
+}
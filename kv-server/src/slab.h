@@ -0,0 +1,97 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ memcached-style slab allocator.
+
+ Chunk sizes grow by SLAB_GROWTH from SLAB_MIN_CHUNK up to SLAB_MAX_CHUNK.
+ Each class carves SLAB_PAGE_SIZE pages into equal chunks and keeps freed
+ chunks on a free list. Requests above SLAB_MAX_CHUNK fall back to malloc
+ and are tracked as the "large" class; the owner allocates those itself
+ (outside its lock if it likes) and keeps large_count/large_bytes up to
+ date. Not thread-safe: the owner (one cache shard) serializes calls
+ under its own lock.
+
+ With a NUMA node set, pages are carved from SLAB_ARENA_SIZE blocks
+ placed on that node instead of coming from malloc one by one, so that
+ slab_move can migrate them as a whole.
+
+ Every chunk also has a 32-bit handle, so the owner can link chunks with
+ 4-byte references instead of pointers: the index of its page in a
+ directory and its offset in the page in 8-byte units (which caps a slab
+ at SLAB_MAX_PAGES pages). Large allocations the owner registers with
+ slab_large_add get handles too, from a table, with SLAB_H_LARGE set.
+ 0 is never a handle.
+*/
+
+#define SLAB_PAGE_SIZE (64 * 1024)
+#define SLAB_MIN_CHUNK 64
+#define SLAB_MAX_CHUNK (16 * 1024)
+#define SLAB_GROWTH 1.25
+#define SLAB_MAX_CLASSES 48
+#define SLAB_LARGE 0xff /* class id of malloc'd allocations */
+#define SLAB_ARENA_SIZE (2 * 1024 * 1024)
+
+typedef uint32_t slab_h;
+#define SLAB_H_LARGE 0x80000000u
+#define SLAB_H_OFF_BITS 13 /* SLAB_PAGE_SIZE / 8 offsets */
+#define SLAB_MAX_PAGES ((1u << (31 - SLAB_H_OFF_BITS)) - 1)
+
+typedef struct {
+    size_t chunk_size;
+    size_t per_page;
+    slab_h free_list;   /* each free chunk holds the handle of the next */
+    void **pages;
+    size_t npages, pages_cap;
+    size_t used; /* chunks handed out */
+    size_t free_chunks;
+} slab_class_t;
+
+typedef struct {
+    slab_class_t classes[SLAB_MAX_CLASSES];
+    int nclasses;
+    size_t large_count, large_bytes;
+    int node;           /* NUMA node of the pages, -1 = wherever malloc puts them */
+    void **arenas;      /* blocks pages are carved from (node >= 0 only) */
+    size_t narenas, arenas_cap;
+    size_t arena_used;  /* bytes of the newest arena handed out */
+    void **dir;         /* pages by handle; entry 0 unused */
+    size_t ndir, dir_cap;
+    void **large;       /* large allocations by handle; free slots chain through it */
+    size_t nlarge, large_cap;
+    size_t large_free;  /* first free slot + 1, 0 = none */
+} slab_t;
+
+void slab_init(slab_t *sl);
+void slab_destroy(slab_t *sl); /* frees all pages; large allocations are the owner's */
+
+/* place pages on NUMA node from now on; only before the first slab_alloc */
+void slab_set_node(slab_t *sl, int node);
+/* migrate every page to node and allocate new ones there; 0 on success */
+int slab_move(slab_t *sl, int node);
+
+/* class that would serve size bytes, or SLAB_LARGE */
+int slab_class_for(const slab_t *sl, size_t size);
+/* bytes actually reserved for an allocation of size in class cls */
+size_t slab_alloc_size(const slab_t *sl, int cls, size_t size);
+
+/* chunk of class cls (never SLAB_LARGE) and its handle in *h; NULL if a
+   new page can't be had */
+void *slab_alloc(slab_t *sl, int cls, slab_h *h);
+void slab_free(slab_t *sl, int cls, void *p, slab_h h);
+
+/* handle for a large allocation the owner made, 0 if out of memory; and
+   giving it back before the allocation is freed */
+slab_h slab_large_add(slab_t *sl, void *p);
+void slab_large_del(slab_t *sl, slab_h h);
+
+static inline void *slab_ptr(const slab_t *sl, slab_h h) {
+    if (!h) return NULL;
+    if (h & SLAB_H_LARGE) return sl->large[h & ~SLAB_H_LARGE];
+    return (char *)sl->dir[h >> SLAB_H_OFF_BITS] + ((size_t)(h & ((1u << SLAB_H_OFF_BITS) - 1)) << 3);
+}
+
+#endif
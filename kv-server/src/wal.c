@@ -0,0 +1,806 @@
+#define _GNU_SOURCE
+#include "wal.h"
+#include "db.h"
+#include "hash.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ Writers append records to an in-memory buffer and wait; the syncer swaps
+ the buffer out, writes it to the current segment and fdatasyncs, which
+ makes every write in it durable at once (group commit). Each record is
+ a wal_rec_t followed by key\0value\0, with a checksum over the rest so
+ that replay stops at a torn tail. Positions in the log are byte offsets
+ since wal_open (LSNs); a record is durable once durable_lsn passes it.
+
+ Besides the log, every key with a write not yet in the database has a
+ pend_t holding its latest write, kept in a hash table for wal_get and on
+ a list ordered by LSN for the flusher. The flusher applies durable
+ entries from the head of that list, and removes each afterwards unless
+ it was written again meanwhile. A record replaced before it is durable
+ stays on the entry's older list until a later one is: wal_get serves
+ the newest durable record, and a write that fails to sync takes its own
+ record back out. A closed segment is removed once it ends before the
+ oldest record still held, since every write in it is then in the
+ database or superseded by a later durable record.
+*/
+
+#define WAL_SEED 0x6b7677616c303031ULL /* fixed: checksums must survive restarts */
+#define WAL_SEG_BYTES (64UL << 20)     /* start a new segment past this */
+#define WAL_BATCH 1000                 /* writes per database transaction */
+
+enum { WAL_PUT = 1, WAL_DEL = 2 };
+
+typedef struct {
+    uint64_t sum;        /* hash_bytes_seed of the header after this, key and value */
+    uint32_t klen, vlen;
+    uint64_t expires_at; /* wall clock ms, 0 = never */
+    uint32_t op;
+    uint32_t pad;
+} wal_rec_t;
+
+typedef struct pver {
+    struct pver *older;
+    uint64_t start, end;
+    uint64_t expires_at;
+    int del;
+    int len;
+    char *value;
+} pver_t;
+
+typedef struct pend {
+    struct pend *hnext;
+    struct pend *prev, *next; /* pending list, by end */
+    uint64_t hash;
+    uint64_t start, end;      /* LSNs of the latest record for the key */
+    uint64_t expires_at;
+    int del;
+    int len;
+    char *value;
+    pver_t *older;            /* earlier records, newest first, until one after them is durable */
+    char key[];
+} pend_t;
+
+typedef struct {
+    unsigned long n;
+    uint64_t end; /* LSN just past its last record */
+} seg_t;
+
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;    /* syncer: buffer filled, or closing */
+static pthread_cond_t durable_cv = PTHREAD_COND_INITIALIZER; /* writers: durable_lsn moved */
+static pthread_cond_t flush_cv = PTHREAD_COND_INITIALIZER;   /* flusher: stop */
+
+static char *wal_prefix;
+static unsigned long flush_interval_ms;
+static int wal_on, closing, flusher_stop, io_error;
+static pthread_t syncer, flusher;
+
+/* all under mu */
+static char *buf;
+static size_t buf_len, buf_cap;
+static uint64_t appended_lsn, durable_lsn;
+static pend_t **tab;
+static size_t nbuckets, npend;
+static pend_t *head, *tail;
+static seg_t *segs; /* closed segments, oldest first */
+static size_t nsegs, segs_cap;
+static unsigned long cur_seg;
+static unsigned long n_records, n_syncs, n_flushed, n_flush_errors;
+
+/* syncer only */
+static int seg_fd = -1;
+static size_t seg_bytes;
+
+static uint64_t wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t rec_sum(const wal_rec_t *r, const char *key, const char *value) {
+    uint64_t s = hash_bytes_seed((const char *)r + sizeof(r->sum), sizeof(*r) - sizeof(r->sum), WAL_SEED);
+    s = hash_bytes_seed(key, r->klen, s);
+    return hash_bytes_seed(value, r->vlen, s);
+}
+
+static char *seg_path(unsigned long n) {
+    char *p = NULL;
+    if (asprintf(&p, "%s.%lu", wal_prefix, n) < 0) return NULL;
+    return p;
+}
+
+/* split wal_prefix into its directory and file name part (both malloc'd) */
+static int prefix_split(char **dir, char **base) {
+    const char *slash = strrchr(wal_prefix, '/');
+    if (slash) {
+        *dir = strndup(wal_prefix, slash == wal_prefix ? 1 : (size_t)(slash - wal_prefix));
+        *base = strdup(slash + 1);
+    } else {
+        *dir = strdup(".");
+        *base = strdup(wal_prefix);
+    }
+    if (!*dir || !*base) { free(*dir); free(*base); return -1; }
+    return 0;
+}
+
+/* make file creation and removal in the log directory durable */
+static void sync_dir(void) {
+    char *dir, *base;
+    if (prefix_split(&dir, &base) != 0) return;
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+    free(base);
+}
+
+static int seg_create(unsigned long n) {
+    char *path = seg_path(n);
+    if (!path) return -1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) fprintf(stderr, "wal: cannot create %s: %s\n", path, strerror(errno));
+    free(path);
+    if (fd >= 0) sync_dir();
+    return fd;
+}
+
+static void seg_remove(unsigned long n) {
+    char *path = seg_path(n);
+    if (!path) return;
+    if (unlink(path) != 0 && errno != ENOENT)
+        fprintf(stderr, "wal: cannot remove %s: %s\n", path, strerror(errno));
+    free(path);
+}
+
+/* ---------- pending writes ---------- */
+
+static pend_t *pend_find(const char *key, size_t klen, uint64_t h) {
+    if (!tab) return NULL;
+    for (pend_t *p = tab[h & (nbuckets - 1)]; p; p = p->hnext)
+        if (p->hash == h && strncmp(p->key, key, klen) == 0 && p->key[klen] == '\0') return p;
+    return NULL;
+}
+
+static void list_unlink(pend_t *p) {
+    if (p->prev) p->prev->next = p->next; else head = p->next;
+    if (p->next) p->next->prev = p->prev; else tail = p->prev;
+    p->prev = p->next = NULL;
+}
+
+static void list_append(pend_t *p) {
+    p->prev = tail;
+    p->next = NULL;
+    if (tail) tail->next = p; else head = p;
+    tail = p;
+}
+
+/* put p back in end order; only records not yet durable follow it */
+static void list_insert(pend_t *p) {
+    pend_t *q = tail;
+    while (q && q->end > p->end) q = q->prev;
+    p->prev = q;
+    p->next = q ? q->next : head;
+    if (p->next) p->next->prev = p; else tail = p;
+    if (q) q->next = p; else head = p;
+}
+
+static void pver_free(pver_t *v) {
+    while (v) {
+        pver_t *next = v->older;
+        free(v->value);
+        free(v);
+        v = next;
+    }
+}
+
+/* drop the records no reader can see any more: all of them once the
+   latest is durable, else those behind the newest durable one */
+static void pend_prune(pend_t *p) {
+    pver_t **vp = &p->older;
+    if (p->end > durable_lsn) {
+        while (*vp && (*vp)->end > durable_lsn) vp = &(*vp)->older;
+        if (*vp) vp = &(*vp)->older;
+    }
+    pver_free(*vp);
+    *vp = NULL;
+}
+
+static int tab_grow(void) {
+    size_t nb = nbuckets ? nbuckets * 2 : 1024;
+    pend_t **t = calloc(nb, sizeof(*t));
+    if (!t) return -1;
+    for (size_t i = 0; i < nbuckets; ++i) {
+        pend_t *p = tab[i];
+        while (p) {
+            pend_t *next = p->hnext;
+            p->hnext = t[p->hash & (nb - 1)];
+            t[p->hash & (nb - 1)] = p;
+            p = next;
+        }
+    }
+    free(tab);
+    tab = t;
+    nbuckets = nb;
+    return 0;
+}
+
+static void pend_remove(pend_t *p) {
+    pend_t **pp = &tab[p->hash & (nbuckets - 1)];
+    while (*pp != p) pp = &(*pp)->hnext;
+    *pp = p->hnext;
+    list_unlink(p);
+    npend--;
+    pver_free(p->older);
+    free(p->value);
+    free(p);
+}
+
+/* take the record ending at end back out of p after its sync failed */
+static void pend_undo(pend_t *p, uint64_t end) {
+    if (p->end != end) {
+        pver_t **vp = &p->older;
+        while (*vp && (*vp)->end != end) vp = &(*vp)->older;
+        pver_t *v = *vp;
+        if (v) {
+            *vp = v->older;
+            free(v->value);
+            free(v);
+        }
+        return;
+    }
+    pver_t *v = p->older;
+    if (!v) {
+        pend_remove(p);
+        return;
+    }
+    free(p->value);
+    p->start = v->start;
+    p->end = v->end;
+    p->expires_at = v->expires_at;
+    p->del = v->del;
+    p->len = v->len;
+    p->value = v->value;
+    p->older = v->older;
+    free(v);
+    list_unlink(p);
+    list_insert(p);
+}
+
+/* ---------- writers ---------- */
+
+static int wal_write(int op, const char *key, const char *value, int len, long ttl_ms) {
+    if (len < 0) return -1;
+    size_t klen = strlen(key);
+    wal_rec_t r = { 0, (uint32_t)klen, (uint32_t)len, ttl_ms > 0 ? wall_ms() + ttl_ms : 0, (uint32_t)op, 0 };
+    if (!value) value = "";
+    r.sum = rec_sum(&r, key, value);
+    size_t need = sizeof(r) + klen + 1 + (size_t)len + 1;
+    uint64_t h = hash_bytes(key, klen);
+
+    /* allocate outside the lock; whatever ends up unused is freed below */
+    pend_t *np = malloc(sizeof(*np) + klen + 1);
+    pver_t *ov = malloc(sizeof(*ov));
+    char *nv = op == WAL_PUT ? malloc((size_t)len + 1) : NULL;
+    if (!np || !ov || (op == WAL_PUT && !nv)) { free(np); free(ov); free(nv); return -1; }
+    if (nv) {
+        memcpy(nv, value, len);
+        nv[len] = '\0';
+    }
+
+    pthread_mutex_lock(&mu);
+    if (!wal_enabled() || closing || io_error) {
+        pthread_mutex_unlock(&mu);
+        free(np);
+        free(ov);
+        free(nv);
+        return -1;
+    }
+    if (buf_len + need > buf_cap) {
+        size_t cap = buf_cap ? buf_cap : 64 * 1024;
+        while (cap < buf_len + need) cap *= 2;
+        char *nb = realloc(buf, cap);
+        if (!nb) {
+            pthread_mutex_unlock(&mu);
+            free(np);
+            free(ov);
+            free(nv);
+            return -1;
+        }
+        buf = nb;
+        buf_cap = cap;
+    }
+    if (npend >= nbuckets && tab_grow() != 0) {
+        pthread_mutex_unlock(&mu);
+        free(np);
+        free(ov);
+        free(nv);
+        return -1;
+    }
+    char *w = buf + buf_len;
+    memcpy(w, &r, sizeof(r));
+    memcpy(w + sizeof(r), key, klen + 1);
+    memcpy(w + sizeof(r) + klen + 1, value, len);
+    w[need - 1] = '\0';
+    buf_len += need;
+    uint64_t start = appended_lsn;
+    appended_lsn += need;
+    uint64_t end = appended_lsn;
+    n_records++;
+
+    pend_t *p = pend_find(key, klen, h);
+    if (p) {
+        /* readers keep the record this replaces until this one is durable */
+        *ov = (pver_t){ p->older, p->start, p->end, p->expires_at, p->del, p->len, p->value };
+        p->older = ov;
+        ov = NULL;
+        list_unlink(p);
+    } else {
+        p = np;
+        np = NULL;
+        memcpy(p->key, key, klen + 1);
+        p->hash = h;
+        p->hnext = tab[h & (nbuckets - 1)];
+        tab[h & (nbuckets - 1)] = p;
+        p->older = NULL;
+        npend++;
+    }
+    p->start = start;
+    p->end = end;
+    p->expires_at = r.expires_at;
+    p->del = op == WAL_DEL;
+    p->value = nv;
+    p->len = len;
+    list_append(p);
+
+    pthread_cond_signal(&work_cv);
+    while (durable_lsn < end && !io_error) pthread_cond_wait(&durable_cv, &mu);
+    int rc = durable_lsn >= end ? 0 : -1;
+    /* the flusher may have applied and removed it by now, but a record
+       that never became durable is still here */
+    p = pend_find(key, klen, h);
+    if (p && rc == 0) pend_prune(p);
+    else if (p) pend_undo(p, end);
+    pthread_mutex_unlock(&mu);
+    free(np);
+    free(ov);
+    return rc;
+}
+
+int wal_put(const char *key, const char *value, int len, long ttl_ms) {
+    return wal_write(WAL_PUT, key, value, len, ttl_ms);
+}
+
+int wal_delete(const char *key) {
+    return wal_write(WAL_DEL, key, NULL, 0, 0);
+}
+
+int wal_get(const char *key, char **value, int *len, long *ttl_ms) {
+    size_t klen = strlen(key);
+    uint64_t h = hash_bytes(key, klen);
+    int rc = -1;
+    pthread_mutex_lock(&mu);
+    pend_t *p = pend_find(key, klen, h);
+    /* the newest durable record: a later one may still fail to sync */
+    const pver_t *v = NULL;
+    if (p && p->end > durable_lsn)
+        for (v = p->older; v && v->end > durable_lsn; v = v->older) {}
+    if (p && (p->end <= durable_lsn || v)) {
+        uint64_t expires_at = v ? v->expires_at : p->expires_at;
+        int vlen = v ? v->len : p->len;
+        uint64_t now = expires_at ? wall_ms() : 0;
+        if ((v ? v->del : p->del) || (expires_at && expires_at <= now)) {
+            rc = 1;
+        } else if ((*value = malloc((size_t)vlen + 1))) {
+            memcpy(*value, v ? v->value : p->value, (size_t)vlen + 1);
+            *len = vlen;
+            *ttl_ms = expires_at ? (long)(expires_at - now) : 0;
+            rc = 0;
+        } else {
+            rc = -2; /* neither the old row nor "no such key" would be true */
+        }
+    }
+    pthread_mutex_unlock(&mu);
+    return rc;
+}
+
+int wal_enabled(void) {
+    return __atomic_load_n(&wal_on, __ATOMIC_RELAXED);
+}
+
+/* ---------- syncer ---------- */
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static void *syncer_main(void *arg) {
+    (void)arg;
+    char *spare = NULL;
+    size_t spare_cap = 0;
+    pthread_mutex_lock(&mu);
+    for (;;) {
+        while (!buf_len && !closing) pthread_cond_wait(&work_cv, &mu);
+        if (!buf_len) break;
+        /* take the whole buffer; writers fill the spare one meanwhile */
+        char *out = buf;
+        size_t n = buf_len, cap = buf_cap;
+        uint64_t end = appended_lsn;
+        buf = spare;
+        buf_cap = spare_cap;
+        buf_len = 0;
+        pthread_mutex_unlock(&mu);
+
+        int ok = write_all(seg_fd, out, n) == 0 && fdatasync(seg_fd) == 0;
+        if (!ok) fprintf(stderr, "wal: write to log failed: %s\n", strerror(errno));
+        seg_bytes += n;
+        int next_fd = -1;
+        if (ok && seg_bytes >= WAL_SEG_BYTES) next_fd = seg_create(cur_seg + 1);
+        spare = out;
+        spare_cap = cap;
+
+        pthread_mutex_lock(&mu);
+        /* after a failed sync nothing later counts as durable either: the
+           records in the lost buffer sit below it in the log */
+        if (ok && !io_error) durable_lsn = end;
+        else io_error = 1;
+        n_syncs++;
+        if (next_fd >= 0) {
+            seg_t *ns = segs;
+            if (nsegs == segs_cap) ns = realloc(segs, (segs_cap ? segs_cap * 2 : 16) * sizeof(*segs));
+            if (ns) {
+                if (ns != segs) { segs = ns; segs_cap = segs_cap ? segs_cap * 2 : 16; }
+                segs[nsegs++] = (seg_t){ cur_seg, end };
+                cur_seg++;
+                close(seg_fd);
+                seg_fd = next_fd;
+                seg_bytes = 0;
+            } else {
+                /* keep appending to the old segment; drop the new one */
+                close(next_fd);
+                seg_remove(cur_seg + 1);
+            }
+        }
+        pthread_cond_broadcast(&durable_cv);
+    }
+    pthread_mutex_unlock(&mu);
+    free(spare);
+    return NULL;
+}
+
+/* ---------- flusher ---------- */
+
+typedef struct {
+    char *key;
+    char *value;
+    uint64_t end;
+} flush_item_t;
+
+/* apply one batch of durable pending writes; 1 if one was applied, 0 if
+   none was due, -1 if the database refused it. Called and returns with mu held. */
+static int flush_batch(db_write_t *w, flush_item_t *it) {
+    int n = 0;
+    uint64_t now = wall_ms();
+    for (pend_t *p = head; p && n < WAL_BATCH && p->end <= durable_lsn; p = p->next) {
+        it[n].key = strdup(p->key);
+        it[n].value = NULL;
+        if (!it[n].key) break;
+        int del = p->del || (p->expires_at && p->expires_at <= now);
+        if (!del && !(it[n].value = malloc((size_t)p->len + 1))) {
+            free(it[n].key);
+            break;
+        }
+        if (!del) memcpy(it[n].value, p->value, (size_t)p->len + 1);
+        it[n].end = p->end;
+        w[n] = (db_write_t){ it[n].key, it[n].value, del ? 0 : p->len,
+                             !del && p->expires_at ? (long)(p->expires_at - now) : 0, del };
+        n++;
+    }
+    if (!n) return 0;
+    pthread_mutex_unlock(&mu);
+    int rc = db_write_batch(w, n);
+    pthread_mutex_lock(&mu);
+    if (rc == 0) {
+        for (int i = 0; i < n; ++i) {
+            size_t klen = strlen(it[i].key);
+            pend_t *p = pend_find(it[i].key, klen, hash_bytes(it[i].key, klen));
+            if (p && p->end == it[i].end) pend_remove(p);
+        }
+        n_flushed += n;
+    } else {
+        n_flush_errors++;
+    }
+    for (int i = 0; i < n; ++i) {
+        free(it[i].key);
+        free(it[i].value);
+    }
+    return rc == 0 ? 1 : -1;
+}
+
+/* remove closed segments that hold nothing still pending; mu held */
+static void trim_segments(void) {
+    uint64_t oldest = head ? head->start : durable_lsn;
+    /* records kept behind a write still syncing: those are all at the tail */
+    for (pend_t *p = tail; p && p->end > durable_lsn; p = p->prev)
+        for (pver_t *v = p->older; v; v = v->older)
+            if (v->start < oldest) oldest = v->start;
+    size_t k = 0;
+    while (k < nsegs && segs[k].end <= oldest) k++;
+    if (!k) return;
+    unsigned long first = segs[0].n;
+    memmove(segs, segs + k, (nsegs - k) * sizeof(*segs));
+    nsegs -= k;
+    pthread_mutex_unlock(&mu);
+    for (size_t i = 0; i < k; ++i) seg_remove(first + i);
+    sync_dir();
+    pthread_mutex_lock(&mu);
+}
+
+static void *flusher_main(void *arg) {
+    (void)arg;
+    db_write_t *w = malloc(WAL_BATCH * sizeof(*w));
+    flush_item_t *it = malloc(WAL_BATCH * sizeof(*it));
+    if (!w || !it) {
+        fprintf(stderr, "wal: flusher out of memory; writes stay in the log until restart\n");
+        free(w);
+        free(it);
+        return NULL;
+    }
+    pthread_mutex_lock(&mu);
+    for (;;) {
+        int stop = flusher_stop;
+        if (!stop) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += flush_interval_ms / 1000;
+            ts.tv_nsec += (long)(flush_interval_ms % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+            pthread_cond_timedwait(&flush_cv, &mu, &ts);
+            stop = flusher_stop;
+        }
+        /* batches until nothing durable is left; on an error the rest
+           waits for the next round */
+        while (flush_batch(w, it) > 0) {}
+        trim_segments();
+        if (stop) break;
+    }
+    pthread_mutex_unlock(&mu);
+    free(w);
+    free(it);
+    return NULL;
+}
+
+/* ---------- replay ---------- */
+
+static int cmp_ulong(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* numbers n of the existing <prefix>.<n> files, sorted; -1 on error */
+static long list_segments(unsigned long **out) {
+    char *dir, *base;
+    if (prefix_split(&dir, &base) != 0) return -1;
+    size_t blen = strlen(base), n = 0, cap = 0;
+    unsigned long *v = NULL;
+    long rc = -1;
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "wal: cannot open directory %s: %s\n", dir, strerror(errno));
+        goto out;
+    }
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        const char *s = de->d_name;
+        if (strncmp(s, base, blen) != 0 || s[blen] != '.' || s[blen + 1] < '0' || s[blen + 1] > '9') continue;
+        char *e;
+        unsigned long num = strtoul(s + blen + 1, &e, 10);
+        if (*e) continue;
+        if (n == cap) {
+            unsigned long *nv = realloc(v, (cap = cap ? cap * 2 : 16) * sizeof(*v));
+            if (!nv) { closedir(d); goto out; }
+            v = nv;
+        }
+        v[n++] = num;
+    }
+    closedir(d);
+    if (n) qsort(v, n, sizeof(*v), cmp_ulong);
+    *out = v;
+    v = NULL;
+    rc = (long)n;
+out:
+    free(v);
+    free(dir);
+    free(base);
+    return rc;
+}
+
+/* apply every intact record of one segment, WAL_BATCH per transaction;
+   records it applied, or -1 if the database refused a batch */
+static long replay_segment(unsigned long num, db_write_t *w) {
+    char *path = seg_path(num);
+    if (!path) return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "wal: cannot open %s: %s\n", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+    struct stat sb;
+    size_t size = fstat(fd, &sb) == 0 ? (size_t)sb.st_size : 0;
+    const char *map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "wal: cannot map %s: %s\n", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+    long total = 0;
+    int n = 0;
+    size_t off = 0;
+    uint64_t now = wall_ms();
+    while (off + sizeof(wal_rec_t) <= size) {
+        wal_rec_t r;
+        memcpy(&r, map + off, sizeof(r));
+        const char *key = map + off + sizeof(r);
+        size_t need = sizeof(r) + (size_t)r.klen + 1 + (size_t)r.vlen + 1;
+        if (need > size - off || key[r.klen] != '\0' || key[r.klen + 1 + r.vlen] != '\0' ||
+            (r.op != WAL_PUT && r.op != WAL_DEL) || rec_sum(&r, key, key + r.klen + 1) != r.sum)
+            break;
+        int del = r.op == WAL_DEL || (r.expires_at && r.expires_at <= now);
+        w[n++] = (db_write_t){ key, key + r.klen + 1, del ? 0 : (int)r.vlen,
+                               !del && r.expires_at ? (long)(r.expires_at - now) : 0, del };
+        off += need;
+        if (n == WAL_BATCH) {
+            if (db_write_batch(w, n) != 0) { total = -1; break; }
+            total += n;
+            n = 0;
+        }
+    }
+    if (total >= 0 && n) {
+        if (db_write_batch(w, n) != 0) total = -1;
+        else total += n;
+    }
+    if (total >= 0 && off < size)
+        fprintf(stderr, "wal: %s: ignoring %zu bytes after the last intact record\n", path, size - off);
+    if (map) munmap((void *)map, size);
+    free(path);
+    return total;
+}
+
+int wal_open(const char *prefix, unsigned long flush_ms) {
+    if (wal_on || !prefix || !*prefix) return -1;
+    hash_seed_init();
+    wal_prefix = strdup(prefix);
+    if (!wal_prefix) return -1;
+    flush_interval_ms = flush_ms ? flush_ms : 100;
+
+    unsigned long *nums = NULL;
+    long nseg = list_segments(&nums);
+    db_write_t *w = malloc(WAL_BATCH * sizeof(*w));
+    if (nseg < 0 || !w) goto fail;
+    long replayed = 0;
+    for (long i = 0; i < nseg; ++i) {
+        long r = replay_segment(nums[i], w);
+        if (r < 0) {
+            fprintf(stderr, "wal: replay into the database failed; log left in place\n");
+            goto fail;
+        }
+        replayed += r;
+    }
+    /* everything is in the database now */
+    for (long i = 0; i < nseg; ++i) seg_remove(nums[i]);
+    if (nseg) {
+        sync_dir();
+        fprintf(stderr, "wal: replayed %ld writes from %ld log segment(s)\n", replayed, nseg);
+    }
+    cur_seg = nseg ? nums[nseg - 1] + 1 : 0;
+    free(nums);
+    nums = NULL;
+    free(w);
+    w = NULL;
+
+    if ((seg_fd = seg_create(cur_seg)) < 0) goto fail;
+    seg_bytes = 0;
+    closing = flusher_stop = io_error = 0;
+    __atomic_store_n(&wal_on, 1, __ATOMIC_RELAXED);
+    if (pthread_create(&syncer, NULL, syncer_main, NULL) != 0) {
+        __atomic_store_n(&wal_on, 0, __ATOMIC_RELAXED);
+        goto fail_fd;
+    }
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+        pthread_mutex_lock(&mu);
+        closing = 1;
+        pthread_cond_signal(&work_cv);
+        pthread_mutex_unlock(&mu);
+        pthread_join(syncer, NULL);
+        __atomic_store_n(&wal_on, 0, __ATOMIC_RELAXED);
+        goto fail_fd;
+    }
+    return 0;
+
+fail_fd:
+    close(seg_fd);
+    seg_fd = -1;
+    seg_remove(cur_seg);
+fail:
+    free(nums);
+    free(w);
+    free(wal_prefix);
+    wal_prefix = NULL;
+    return -1;
+}
+
+void wal_close(void) {
+    if (!wal_on) return;
+    /* no new writes; the syncer writes out what is buffered and exits */
+    pthread_mutex_lock(&mu);
+    closing = 1;
+    pthread_cond_signal(&work_cv);
+    pthread_mutex_unlock(&mu);
+    pthread_join(syncer, NULL);
+
+    /* one last flush of everything durable */
+    pthread_mutex_lock(&mu);
+    flusher_stop = 1;
+    pthread_cond_signal(&flush_cv);
+    pthread_mutex_unlock(&mu);
+    pthread_join(flusher, NULL);
+
+    close(seg_fd);
+    seg_fd = -1;
+    if (!head) {
+        for (size_t i = 0; i < nsegs; ++i) seg_remove(segs[i].n);
+        seg_remove(cur_seg);
+        sync_dir();
+    } else {
+        fprintf(stderr, "wal: %zu keys not flushed to the database; they stay in the log for the next start\n", npend);
+        while (head) pend_remove(head);
+    }
+    free(tab);
+    tab = NULL;
+    nbuckets = npend = 0;
+    free(segs);
+    segs = NULL;
+    nsegs = segs_cap = 0;
+    free(buf);
+    buf = NULL;
+    buf_len = buf_cap = 0;
+    appended_lsn = durable_lsn = 0;
+    free(wal_prefix);
+    wal_prefix = NULL;
+    __atomic_store_n(&wal_on, 0, __ATOMIC_RELAXED);
+}
+
+void wal_stats(wal_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    pthread_mutex_lock(&mu);
+    st->records = n_records;
+    st->syncs = n_syncs;
+    st->pending = npend;
+    st->flushed = n_flushed;
+    st->flush_errors = n_flush_errors;
+    st->segments = wal_on ? nsegs + 1 : 0;
+    pthread_mutex_unlock(&mu);
+}
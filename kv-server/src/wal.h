@@ -0,0 +1,52 @@
+#ifndef WAL_H
+#define WAL_H
+
+/*
+ Write-back log. A write is appended to a local log and acknowledged once
+ the log is fsync'ed; a syncer thread batches the fsyncs, so concurrent
+ writers share one. A flusher thread applies logged writes to PostgreSQL
+ in batches, each in one transaction, and drops log segments once
+ everything in them is in the database. Until then reads must ask wal_get
+ first, since the database may still hold an older value.
+
+ The log lives in files <prefix>.<n>, started anew at each
+ wal_open after the previous ones have been replayed into the database.
+*/
+
+/* Replay any log left under prefix into the database (needs db_init),
+   remove it, and start the syncer and flusher; the flusher runs every
+   flush_ms. 0 on success, -1 if the log could not be replayed or opened
+   (it is then left in place). */
+int wal_open(const char *prefix, unsigned long flush_ms);
+
+/* Flush everything still pending to the database and stop the threads;
+   call before db_shutdown, once no writer is left. Whatever could not be
+   flushed stays in the log for the next wal_open. */
+void wal_close(void);
+
+/* nonzero between wal_open and wal_close */
+int wal_enabled(void);
+
+/* Log a put (ttl_ms as for db_put) or a delete; returns 0 once it is
+   durable, -1 if it could not be logged. */
+int wal_put(const char *key, const char *value, int len, long ttl_ms);
+int wal_delete(const char *key);
+
+/* A logged write not yet in the database: 0 and a malloc'd copy of the
+   value (NUL terminated, caller frees) for a put, with the ttl left in
+   *ttl_ms (0 = none); 1 for a delete or an expired put; -1 if the
+   database is current for key; -2 if the copy could not be made. */
+int wal_get(const char *key, char **value, int *len, long *ttl_ms);
+
+typedef struct {
+    unsigned long records;       /* writes logged */
+    unsigned long syncs;         /* fsyncs that made them durable */
+    unsigned long pending;       /* keys with a write not yet in the database */
+    unsigned long flushed;       /* writes applied to the database */
+    unsigned long flush_errors;  /* batches the database refused (retried) */
+    unsigned long segments;      /* log files on disk */
+} wal_stats_t;
+
+void wal_stats(wal_stats_t *st);
+
+#endif
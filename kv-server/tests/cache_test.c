@@ -0,0 +1,64 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ Cache behaviour checks that need no server or database. Each check
+ prints what failed; the exit status is the number of failures.
+*/
+
+static int failures;
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                       \
+        }                                                                     \
+    } while (0)
+
+static int refresh_later(const cache_key_t *key) {
+    (void)key;
+    return -1;
+}
+
+/* one hit counts in hits only, one miss in misses only; with refresh_ms
+   the hit is stale and queues a reload */
+static void test_hit_miss_counts(unsigned long refresh_ms) {
+    cache_config_t cfg = {0};
+    cfg.capacity = 100;
+    cfg.nshards = 1;
+    cfg.refresh_ms = refresh_ms;
+    cfg.stale_ms = 10000;
+    cfg.refresh = refresh_later;
+    CHECK(cache_init(&cfg) == 0);
+    cache_key_t k, absent;
+    cache_key_init(&k, "k1");
+    cache_key_init(&absent, "nope");
+    CHECK(cache_put(&k, "v", 1) == 0);
+    if (refresh_ms) usleep(refresh_ms * 2000);
+    cache_stats_t before, after;
+    cache_stats(&before);
+    cache_value_t v;
+    CHECK(cache_get(&k, &v) == 0);
+    CHECK(v.len == 1 && memcmp(v.data, "v", 1) == 0);
+    cache_value_release(&v);
+    cache_stats(&after);
+    CHECK(after.hits == before.hits + 1);
+    CHECK(after.misses == before.misses);
+    CHECK(after.stale_hits == before.stale_hits + (refresh_ms ? 1 : 0));
+    CHECK(cache_get(&absent, &v) == -1);
+    cache_stats(&before);
+    CHECK(before.hits == after.hits);
+    CHECK(before.misses == after.misses + 1);
+    cache_free();
+}
+
+int main(void) {
+    test_hit_miss_counts(0);
+    test_hit_miss_counts(5);
+    if (failures) fprintf(stderr, "cache_test: %d failed\n", failures);
+    else printf("cache_test: ok\n");
+    return failures;
+}
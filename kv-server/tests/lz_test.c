@@ -0,0 +1,134 @@
+#include "lz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ Round trips through lz_compress and lz_decompress, and blocks the
+ decoder must refuse. The exit status is the number of failures.
+*/
+
+static int failures;
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                       \
+        }                                                                     \
+    } while (0)
+
+static unsigned long rnd_state = 88172645463325252UL;
+
+static unsigned char rnd(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return (unsigned char)rnd_state;
+}
+
+static void fill_random(char *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) p[i] = (char)rnd();
+}
+
+/* compress and decode n bytes into buffers of exactly the sizes needed,
+   so that any write past them shows under a sanitizer; returns the
+   compressed block (caller frees) and its length in *clen */
+static char *round_trip(const char *src, size_t n, size_t *clen) {
+    char *c = malloc(LZ_BOUND(n));
+    char *out = malloc(n ? n : 1);
+    *clen = lz_compress(src, n, c, LZ_BOUND(n));
+    CHECK(*clen > 0 && *clen <= LZ_BOUND(n));
+    CHECK(lz_decompress(c, *clen, out, n) == 0);
+    CHECK(memcmp(out, src, n) == 0);
+    free(out);
+    return c;
+}
+
+static void test_incompressible(void) {
+    static const size_t sizes[] = { 0, 1, 4, 12, 13, 15, 16, 17, 100, 255, 256, 270, 4096, 70000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        size_t n = sizes[i], clen;
+        char *src = malloc(n ? n : 1);
+        fill_random(src, n);
+        free(round_trip(src, n, &clen));
+        free(src);
+    }
+}
+
+/* nlit distinct bytes, then a match back to their start: the block opens
+   with a literal run of exactly nlit */
+static void test_literal_runs(void) {
+    static const size_t runs[] = { 7, 8, 9, 14, 15, 16, 17, 270 };
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i) {
+        size_t nlit = runs[i], n = nlit + 32 + 16, clen;
+        char *src = malloc(n);
+        fill_random(src, nlit);
+        for (size_t j = 0; j < 32; ++j) src[nlit + j] = src[j];
+        fill_random(src + nlit + 32, 16);
+        char *c = round_trip(src, n, &clen);
+        unsigned token = (unsigned char)c[0];
+        CHECK((token >> 4) == (nlit < 15 ? nlit : 15));
+        if (nlit >= 15) CHECK((size_t)(unsigned char)c[1] == (nlit - 15 < 255 ? nlit - 15 : 255));
+        free(c);
+        free(src);
+    }
+}
+
+/* a short period repeated: matches that overlap the bytes they write */
+static void test_overlapping_matches(void) {
+    for (size_t period = 1; period < 8; ++period) {
+        size_t n = 300, clen;
+        char *src = malloc(n);
+        fill_random(src, period);
+        for (size_t i = period; i < n - 10; ++i) src[i] = src[i - period];
+        fill_random(src + n - 10, 10);
+        char *c = round_trip(src, n, &clen);
+        CHECK(clen < n / 4);
+        free(c);
+        free(src);
+    }
+}
+
+static void test_bad_blocks(void) {
+    size_t n = 2000, clen;
+    char *src = malloc(n);
+    for (size_t i = 0; i < n; ++i) src[i] = "abcdefgh"[rnd() & 7];
+    char *c = round_trip(src, n, &clen);
+    char *out = malloc(n + 1);
+    /* every truncation is refused: the last sequence carries literals */
+    for (size_t k = 0; k < clen; ++k) CHECK(lz_decompress(c, k, out, n) == -1);
+    /* so is the wrong decoded length */
+    CHECK(lz_decompress(c, clen, out, n - 1) == -1);
+    CHECK(lz_decompress(c, clen, out, n + 1) == -1);
+    /* a damaged byte anywhere must not get out of the buffers; it may
+       still decode, to other bytes */
+    char *bad = malloc(clen);
+    for (size_t k = 0; k < clen; ++k) {
+        memcpy(bad, c, clen);
+        bad[k] ^= (char)(1 + (rnd() % 255));
+        (void)lz_decompress(bad, clen, out, n);
+    }
+    free(bad);
+    /* offset 0, and one reaching before the start of the output */
+    static const char zero_off[] = { 0x10, 'a', 0x00, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' };
+    static const char far_off[] = { 0x10, 'a', 0x02, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' };
+    CHECK(lz_decompress(zero_off, sizeof(zero_off), out, 10) == -1);
+    CHECK(lz_decompress(far_off, sizeof(far_off), out, 10) == -1);
+    /* a literal length running past the block */
+    static const char long_lit[] = { (char)0xf0, (char)255, (char)255 };
+    CHECK(lz_decompress(long_lit, sizeof(long_lit), out, n) == -1);
+    free(out);
+    free(c);
+    free(src);
+}
+
+int main(void) {
+    test_incompressible();
+    test_literal_runs();
+    test_overlapping_matches();
+    test_bad_blocks();
+    if (failures) fprintf(stderr, "lz_test: %d failed\n", failures);
+    else printf("lz_test: ok\n");
+    return failures;
+}
@@ -178,6 +178,53 @@ static int do_request(CURL *eh, const char *method, const char *base_target, con
     }
 }
 
+/* server-side cache counters from GET /metrics */
+typedef struct { unsigned long hits, misses; char policy[32]; int ok; } server_metrics_t;
+
+typedef struct { char buf[4096]; size_t len; } body_buf_t;
+
+static size_t collect_body(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    body_buf_t *b = (body_buf_t *)userdata;
+    size_t n = size * nmemb;
+    size_t room = sizeof(b->buf) - 1 - b->len;
+    size_t take = n < room ? n : room;
+    memcpy(b->buf + b->len, ptr, take);
+    b->len += take;
+    b->buf[b->len] = '\0';
+    return n;
+}
+
+static unsigned long json_ulong(const char *body, const char *field) {
+    const char *p = strstr(body, field);
+    if (!p) return 0;
+    p = strchr(p, ':');
+    return p ? strtoul(p + 1, NULL, 10) : 0;
+}
+
+/* snapshot /metrics so the summary can report the hit ratio seen during the run */
+static void fetch_metrics(server_metrics_t *m) {
+    memset(m, 0, sizeof(*m));
+    CURL *eh = curl_easy_init();
+    if (!eh) return;
+    char url[MAX_URL_LEN];
+    body_buf_t body = { .len = 0 };
+    body.buf[0] = '\0';
+    snprintf(url, sizeof(url), "%s/metrics", cfg.target);
+    curl_easy_setopt(eh, CURLOPT_URL, url);
+    curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(eh, CURLOPT_TIMEOUT_MS, 5000L);
+    curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, collect_body);
+    curl_easy_setopt(eh, CURLOPT_WRITEDATA, &body);
+    if (curl_easy_perform(eh) == CURLE_OK && strstr(body.buf, "\"cache_hits\"")) {
+        m->hits = json_ulong(body.buf, "\"cache_hits\"");
+        m->misses = json_ulong(body.buf, "\"cache_misses\"");
+        const char *p = strstr(body.buf, "\"cache_policy\":\"");
+        if (p) sscanf(p + strlen("\"cache_policy\":\""), "%31[^\"]", m->policy);
+        m->ok = 1;
+    }
+    curl_easy_cleanup(eh);
+}
+
 /* parse a ratio string G:P:D */
 static int parse_ratio_str(const char *s, int *g, int *p, int *d) {
     if (!s) return -1;
@@ -337,7 +384,7 @@ static int seed_database(void) {
 }
 
 /* print final summary */
-static void print_summary(int duration) {
+static void print_summary(int duration, const server_metrics_t *before, const server_metrics_t *after) {
     unsigned long treqs = (unsigned long)atomic_load(&total_reqs);
     unsigned long tsucc = (unsigned long)atomic_load(&total_success);
     unsigned long tfail = (unsigned long)atomic_load(&total_fail);
@@ -356,6 +403,11 @@ static void print_summary(int duration) {
     printf("GET total=%lu OK=%lu\n", (unsigned long)atomic_load(&total_get), (unsigned long)atomic_load(&total_get_ok));
     printf("POST total=%lu OK=%lu\n", (unsigned long)atomic_load(&total_post), (unsigned long)atomic_load(&total_post_ok));
     printf("DELETE total=%lu OK=%lu\n", (unsigned long)atomic_load(&total_delete), (unsigned long)atomic_load(&total_delete_ok));
+    if (before->ok && after->ok) {
+        unsigned long h = after->hits - before->hits, m = after->misses - before->misses;
+        printf("Server cache (policy=%s): hits=%lu misses=%lu hit ratio=%.4f\n",
+               after->policy[0] ? after->policy : "?", h, m, (h + m) ? (double)h / (double)(h + m) : 0.0);
+    }
 }
 
 /* usage */
@@ -440,6 +492,9 @@ int main(int argc, char **argv) {
         }
     }
 
+    server_metrics_t m_before, m_after;
+    fetch_metrics(&m_before);
+
     /* start workers */
     pthread_t *workers = calloc((size_t)cfg.threads, sizeof(pthread_t));
     worker_arg_t *wargs = calloc((size_t)cfg.threads, sizeof(worker_arg_t));
@@ -467,7 +522,8 @@ int main(int argc, char **argv) {
     for (int i=0;i<cfg.threads;i++) pthread_join(workers[i], NULL);
 
     /* summary */
-    print_summary(cfg.duration);
+    fetch_metrics(&m_after);
+    print_summary(cfg.duration, &m_before, &m_after);
 
     curl_global_cleanup();
     free(workers);